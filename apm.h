@@ -4,6 +4,7 @@
 #define _APM_H_
 
 #include <linux/string.h> /* for memmove */
+#include <linux/workqueue.h>
 
 #include "apm_internal.h"
 
@@ -40,16 +41,16 @@ typedef uint64_t apm_digit;
 typedef uint32_t apm_size;
 
 /* Set u[size] to zero. */
-#define apm_zero(u, size) memset((u), 0, APM_DIGIT_SIZE *(size))
+#define apm_zero(u, size) memset((u), 0, APM_DIGIT_SIZE * (size_t) (size))
 
 /* Copy u[size] onto v[size]. */
-#define apm_copy(u, size, v) memmove((v), (u), APM_DIGIT_SIZE *(size))
+#define apm_copy(u, size, v) memmove((v), (u), APM_DIGIT_SIZE * (size_t) (size))
 
 /* Allocate an uninitialized size-digit number. */
 static inline apm_digit *apm_new(apm_size size)
 {
     ASSERT(size != 0);
-    return MALLOC(size * APM_DIGIT_SIZE);
+    return MALLOC((size_t) size * APM_DIGIT_SIZE);
 }
 
 /* Allocate a zeroed out size-digit number. */
@@ -63,7 +64,7 @@ static inline apm_digit *apm_new0(apm_size size)
 static inline apm_digit *apm_resize(apm_digit *u, apm_size size)
 {
     if (u)
-        return REALLOC(u, size * APM_DIGIT_SIZE);
+        return REALLOC(u, (size_t) size * APM_DIGIT_SIZE);
     return apm_new(size);
 }
 
@@ -163,6 +164,44 @@ void apm_mul(const apm_digit *u,
 /* Set v[usize*2] = u[usize]^2. */
 void apm_sqr(const apm_digit *u, apm_size usize, apm_digit *v);
 
+/* Set w[usize + vsize] = u[usize] * v[vsize] by number theoretic transforms.
+ * Return false, with w untouched, if there is not enough memory. Only built
+ * for 64-bit digits, where NTT_MUL_THRESHOLD is defined. */
+bool apm_mul_ntt(const apm_digit *u,
+                 apm_size usize,
+                 const apm_digit *v,
+                 apm_size vsize,
+                 apm_digit *w);
+
+/* A sub-product of a recursive multiplication or squaring, w = u * v for
+ * size-digit u and v, that apm_fork may hand to another CPU. fn works in
+ * scratch when run in place, and in scratch_size digits of its own when run
+ * elsewhere. */
+struct apm_task {
+    struct work_struct work;
+    void (*fn)(const apm_digit *u,
+               const apm_digit *v,
+               apm_size size,
+               apm_digit *w,
+               apm_digit *scratch);
+    const apm_digit *u, *v;
+    apm_size size;
+    apm_digit *w;
+    apm_digit *scratch;
+    size_t scratch_size;
+    bool forked;
+};
+
+/* Start T on another CPU if it has at least APM_PARALLEL_THRESHOLD digits and
+ * one is free, otherwise run it now. apm_join waits for it to finish. */
+void apm_fork(struct apm_task *t);
+void apm_join(struct apm_task *t);
+
+/* Set up and tear down the workers behind apm_fork. Until apm_task_init is
+ * called every task runs in place. */
+int apm_task_init(void);
+void apm_task_exit(void);
+
 /* Multiply or divide by a power of two, with power taken modulo APM_DIGIT_BITS,
  * and return the carry (left shift) or remainder (right shift). */
 apm_digit apm_lshift(const apm_digit *u,
@@ -172,6 +211,43 @@ apm_digit apm_lshift(const apm_digit *u,
 apm_digit apm_lshifti(apm_digit *u, apm_size size, unsigned int shift);
 apm_digit apm_rshifti(apm_digit *u, apm_size size, unsigned int shift);
 
+/* Return the size of the buffer, '\0' included, that apm_sprint needs to
+ * print u[size] in radix. */
+size_t apm_sprint_size(const apm_digit *u, apm_size size, unsigned int radix);
+/* The same for any number below 2^bits. */
+size_t apm_sprint_size_bits(uint64_t bits, unsigned int radix);
+
+/* Print u[size] in a radix on [2,36] straight into dst, which must hold
+ * apm_sprint_size() bytes, and return the length of the string. */
+size_t apm_sprint(const apm_digit *u,
+                  apm_size size,
+                  unsigned int radix,
+                  char *dst);
+
+/* Destination of apm_write_dec. Digits collect in buf[size]; each time it
+ * fills up, flush is called to pass on its len bytes and should return 0 or a
+ * negative error code. Without flush, digits past size are dropped.
+ */
+struct apm_sink {
+    char *buf;
+    size_t size;
+    size_t len;   /* Bytes in buf. */
+    size_t total; /* Bytes written so far, dropped ones included. */
+    int (*flush)(struct apm_sink *sk);
+    int err; /* First error from flush. */
+};
+
+/* Append n bytes from p to sk. */
+void apm_sink_put(struct apm_sink *sk, const char *p, size_t n);
+
+/* Write the decimal digits of u[size] to sk, most significant first, without
+ * '\0', flush what is left in buf, and return the number of digits or the
+ * error from flush. */
+ssize_t apm_write_dec(const apm_digit *u, apm_size size, struct apm_sink *sk);
+
+/* Release the powers of ten cached by decimal conversion. */
+void apm_format_exit(void);
+
 /* Print u[size] in a radix on [2,36] to dst, at most max_len bytes  */
 void apm_snprint(const apm_digit *u,
                  apm_size size,
@@ -10,10 +10,39 @@
 #endif
 #endif
 
-/* Tunable parameters: Karatsuba multiplication and squaring cutoff. */
+/* Tunable parameters: Karatsuba multiplication and squaring cutoff, and
+ * where multiplication and squaring move on to Toom-3. */
 #define KARATSUBA_MUL_THRESHOLD 32
+#ifndef TOOM3_MUL_THRESHOLD
+#define TOOM3_MUL_THRESHOLD 256
+#endif
+#ifndef TOOM3_SQR_THRESHOLD
+#define TOOM3_SQR_THRESHOLD 256
+#endif
+
+/* From here on multiplication and squaring go through number theoretic
+ * transforms, which need 64-bit digits. */
+#if APM_DIGIT_SIZE == 8
+#ifndef NTT_MUL_THRESHOLD
+#define NTT_MUL_THRESHOLD 16384
+#endif
+#ifndef NTT_SQR_THRESHOLD
+#define NTT_SQR_THRESHOLD 8192
+#endif
+#endif
 #define KARATSUBA_SQR_THRESHOLD 64
 
+/* Size from which decimal conversion splits the number in halves by powers of
+ * ten instead of dividing it by one digit's worth of ten at a time. */
+#ifndef DC_GET_STR_THRESHOLD
+#define DC_GET_STR_THRESHOLD 32
+#endif
+
+/* Size from which the sub-products of a Karatsuba step run in parallel. */
+#ifndef APM_PARALLEL_THRESHOLD
+#define APM_PARALLEL_THRESHOLD 1024
+#endif
+
 #if APM_DIGIT_SIZE == 4
 #if defined(i386) || defined(__i386__)
 #define digit_mul(u, v, hi, lo) \
@@ -35,7 +64,7 @@
 #define APM_TMP_ALLOC(size) apm_new(size)
 #define APM_TMP_FREE(num) apm_free(num)
 #define APM_TMP_COPY(num, size) \
-    memcpy(APM_TMP_ALLOC(size), (num), (size) *APM_DIGIT_SIZE)
+    memcpy(APM_TMP_ALLOC(size), (num), (size_t) (size) * APM_DIGIT_SIZE)
 
 /* If we have no inline assembly versions of these primitive operations,
  * fall back onto the generic one.
@@ -47,7 +47,7 @@ void bn_free(bn *n)
     apm_free(n->digits);
 }
 
-static void bn_set(bn *p, const bn *q)
+void bn_set(bn *p, const bn *q)
 {
     ASSERT(p != NULL);
     ASSERT(q != NULL);
@@ -180,6 +180,16 @@ void bn_add(const bn *a, const bn *b, bn *c)
     c->size = size;
 }
 
+void bn_sub(const bn *a, const bn *b, bn *c)
+{
+    ASSERT(b != c);
+
+    /* B with its sign flipped, sharing its digits. */
+    bn neg = *b;
+    neg.sign ^= 1;
+    bn_add(a, &neg, c);
+}
+
 void bn_mul(const bn *a, const bn *b, bn *c)
 {
     if (a->size == 0 || b->size == 0) {
@@ -233,6 +243,44 @@ void bn_sqr(const bn *a, bn *b)
     b->sign = 0;
 }
 
+static void bn_sqr_task_fn(const apm_digit *u,
+                           const apm_digit *v,
+                           apm_size size,
+                           apm_digit *w,
+                           apm_digit *scratch)
+{
+    apm_sqr(u, size, w);
+}
+
+void bn_sqr_fork(struct bn_sqr_task *t, const bn *a, bn *b)
+{
+    ASSERT(a != b);
+    t->b = b;
+    t->task.size = a->size;
+    t->task.forked = false;
+    if (a->size == 0)
+        return;
+
+    BN_MIN_ALLOC(b, a->size * 2);
+    t->task.fn = bn_sqr_task_fn;
+    t->task.u = t->task.v = a->digits;
+    t->task.w = b->digits;
+    t->task.scratch = NULL; /* apm_sqr allocates its own */
+    t->task.scratch_size = 0;
+    apm_fork(&t->task);
+}
+
+void bn_sqr_join(struct bn_sqr_task *t)
+{
+    apm_join(&t->task);
+    const apm_size bsize = t->task.size * 2;
+    if (bsize)
+        t->b->size = bsize - (t->b->digits[bsize - 1] == 0);
+    else
+        t->b->size = 0;
+    t->b->sign = 0;
+}
+
 void bn_lshift(const bn *p, unsigned int bits, bn *q)
 {
     if (bits == 0 || bn_is_zero(p)) {
@@ -290,3 +338,30 @@ void bn_snprint(const bn *n, unsigned int base, char *dst, size_t max_len)
 
     apm_snprint(n->digits, n->size, base, dst, max_len);
 }
+
+size_t bn_sprint_size(const bn *n, unsigned int base)
+{
+    return n->sign + apm_sprint_size(n->digits, n->size, base);
+}
+
+size_t bn_sprint(const bn *n, unsigned int base, char *dst)
+{
+    if (n->size == 0) {
+        dst[0] = '0';
+        dst[1] = '\0';
+        return 1;
+    }
+
+    if (n->sign) {
+        dst[0] = '-';
+        return 1 + apm_sprint(n->digits, n->size, base, dst + 1);
+    }
+    return apm_sprint(n->digits, n->size, base, dst);
+}
+
+ssize_t bn_write_dec(const bn *n, struct apm_sink *sk)
+{
+    if (n->sign && n->size)
+        apm_sink_put(sk, "-", 1);
+    return apm_write_dec(n->digits, n->size, sk);
+}
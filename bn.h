@@ -30,6 +30,9 @@ void bn_free(bn *p);
 
 void bn_set_u32(bn *p, uint32_t q);
 
+/* P = Q */
+void bn_set(bn *p, const bn *q);
+
 #define bn_is_zero(n) ((n)->size == 0)
 void bn_zero(bn *p);
 
@@ -40,14 +43,37 @@ void bn_lshift(const bn *p, unsigned int bits, bn *q);
 /* S = A + B */
 void bn_add(const bn *a, const bn *b, bn *s);
 
+/* D = A - B, where D must not be B */
+void bn_sub(const bn *a, const bn *b, bn *d);
+
 /* P = A * B */
 void bn_mul(const bn *a, const bn *b, bn *p);
 
 /* B = A * A */
 void bn_sqr(const bn *a, bn *b);
 
+/* B = A * A, where B must not be A, started by apm_fork so that it may run on
+ * another CPU. B is only usable after bn_sqr_join. */
+struct bn_sqr_task {
+    struct apm_task task;
+    bn *b;
+};
+void bn_sqr_fork(struct bn_sqr_task *t, const bn *a, bn *b);
+void bn_sqr_join(struct bn_sqr_task *t);
+
 void bn_snprint(const bn *n, unsigned int base, char *dst, size_t max_len);
 
+/* Size of the buffer, '\0' included, that bn_sprint needs for N. */
+size_t bn_sprint_size(const bn *n, unsigned int base);
+
+/* Print N straight into dst, which must hold bn_sprint_size() bytes, and
+ * return the length of the string. */
+size_t bn_sprint(const bn *n, unsigned int base, char *dst);
+
+/* Write N in decimal to sk, in chunks of sk->size bytes, and return its
+ * length or the error from sk->flush. */
+ssize_t bn_write_dec(const bn *n, struct apm_sink *sk);
+
 #ifdef __cplusplus
 }
 #endif
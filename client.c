@@ -1,10 +1,16 @@
 #include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "fibdrv.h"
+
 #define FIB_DEV "/dev/fibonacci"
 #define BUFF_SIZE 100
 
@@ -16,6 +22,215 @@
  */
 #define NUM_MODE 2
 
+static void fail(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static int open_dev(void)
+{
+    int fd = open(FIB_DEV, O_RDWR);
+    if (fd < 0)
+        fail("Failed to open character device");
+    return fd;
+}
+
+/* Print a number in FIB_FMT_RAW form, in hex, and return its end. */
+static const void *print_raw(const char *tag,
+                             int i,
+                             const struct fib_raw_header *h)
+{
+    const unsigned char *limbs = (const unsigned char *) (h + 1);
+
+    printf("%s from " FIB_DEV " at offset %d, returned the sequence 0x", tag,
+           i);
+    if (!h->size)
+        printf("0");
+    for (unsigned int j = h->size; j-- > 0;) {
+        unsigned long long limb;
+        if (h->digit_size == 4) {
+            uint32_t l;
+            memcpy(&l, limbs + j * 4, 4);
+            limb = l;
+        } else {
+            uint64_t l;
+            memcpy(&l, limbs + j * 8, 8);
+            limb = l;
+        }
+        if (j == h->size - 1)
+            printf("%llx", limb);
+        else
+            printf("%0*llx", (int) h->digit_size * 2, limb);
+    }
+    printf(".\n");
+    return limbs + (size_t) h->size * h->digit_size;
+}
+
+/* F(0) .. F(offset) from a single FIB_IOC_RANGE. */
+static void test_range(int offset)
+{
+    static uint64_t buf[1 << 13];
+    struct fib_range range = {
+        .start = 0,
+        .count = offset + 1,
+        .buf = (uintptr_t) buf,
+        .len = sizeof(buf),
+    };
+
+    int fd = open_dev();
+    if (ioctl(fd, FIB_IOC_RANGE, &range) < 0)
+        fail("FIB_IOC_RANGE");
+    if (range.count != (__u64) offset + 1) {
+        fprintf(stderr, "FIB_IOC_RANGE returned %llu numbers\n",
+                (unsigned long long) range.count);
+        exit(1);
+    }
+
+    const void *p = buf;
+    for (int i = 0; i <= offset; i++)
+        p = print_raw("Range", i, p);
+    close(fd);
+}
+
+/* F(0) .. F(offset) computed into an mmap region by FIB_IOC_COMPUTE, in
+ * decimal and raw form by turns.
+ */
+static void test_mmap(int offset)
+{
+    const size_t len = 4096;
+    int fd = open_dev();
+    char *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        fail("mmap");
+
+    for (int i = 0; i <= offset; i++) {
+        struct fib_compute req = {
+            .index = i,
+            .format = i & 1 ? FIB_FMT_RAW : FIB_FMT_DEC,
+        };
+        if (ioctl(fd, FIB_IOC_COMPUTE, &req) < 0)
+            fail("FIB_IOC_COMPUTE");
+        if (req.format == FIB_FMT_RAW)
+            print_raw("Mmap", i, (const struct fib_raw_header *) map);
+        else
+            printf("Mmap from " FIB_DEV
+                   " at offset %d, returned the sequence %s.\n",
+                   i, map);
+    }
+
+    munmap(map, len);
+    close(fd);
+}
+
+/* F(0) .. F(offset) read in FIB_FMT_RAW form. */
+static void test_raw(int offset)
+{
+    uint64_t buf[BUFF_SIZE / sizeof(uint64_t)];
+    int fd = open_dev();
+    if (ioctl(fd, FIB_IOC_SET_FORMAT, FIB_FMT_RAW) < 0)
+        fail("FIB_IOC_SET_FORMAT");
+
+    for (int i = 0; i <= offset; i++) {
+        lseek(fd, i, SEEK_SET);
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < (ssize_t) sizeof(struct fib_raw_header))
+            fail("read");
+        print_raw("Raw", i, (const struct fib_raw_header *) buf);
+    }
+    close(fd);
+}
+
+/* Bytes asked for by each read of test_stream, so that every result but the
+ * smallest takes several.
+ */
+#define STREAM_CHUNK 4
+
+/* F(0) .. F(offset) in decimal, each collected over successive reads until
+ * read returns 0.
+ */
+static void test_stream(int offset)
+{
+    char buf[BUFF_SIZE];
+    int fd = open_dev();
+    if (ioctl(fd, FIB_IOC_SET_FORMAT, FIB_FMT_DEC) < 0)
+        fail("FIB_IOC_SET_FORMAT");
+
+    for (int i = 0; i <= offset; i++) {
+        size_t len = 0;
+        ssize_t n = 0;
+
+        lseek(fd, i, SEEK_SET);
+        while (len + STREAM_CHUNK <= sizeof(buf) &&
+               (n = read(fd, buf + len, STREAM_CHUNK)) > 0)
+            len += n;
+        if (n < 0)
+            fail("read");
+        if (n > 0 || !len || buf[len - 1]) {
+            fprintf(stderr, "F(%d) did not end after %zu bytes\n", i, len);
+            exit(1);
+        }
+        printf("Stream from " FIB_DEV
+               " at offset %d, returned the sequence %s.\n",
+               i, buf);
+    }
+    close(fd);
+}
+
+/* Read F(i) in decimal into buf, which holds size bytes. */
+static void read_dec(int fd, int i, char *buf, size_t size)
+{
+    lseek(fd, i, SEEK_SET);
+    if (read(fd, buf, size) <= 0)
+        fail("read");
+}
+
+/* Indices two up and one down from the last, from F(900) to F(999), which
+ * the driver derives from its cached pair instead of computing them anew.
+ */
+static void test_step(void)
+{
+    char buf[256];
+    int fd = open_dev();
+    if (ioctl(fd, FIB_IOC_SET_FORMAT, FIB_FMT_DEC) < 0)
+        fail("FIB_IOC_SET_FORMAT");
+
+    for (int i = 900, up = 1; i < 1000; i += up ? 2 : -1, up = !up) {
+        read_dec(fd, i, buf, sizeof(buf));
+        printf("Step from " FIB_DEV
+               " at offset %d, returned the sequence %s.\n",
+               i, buf);
+    }
+    close(fd);
+}
+
+/* F(0) .. F(offset) by FIB_IOC_SUBMIT, each read once poll reports it
+ * ready, without a seek: the read moves to the submitted index itself.
+ */
+static void test_submit(int offset)
+{
+    char buf[BUFF_SIZE];
+    int fd = open_dev();
+    if (ioctl(fd, FIB_IOC_SET_FORMAT, FIB_FMT_DEC) < 0)
+        fail("FIB_IOC_SET_FORMAT");
+
+    for (int i = 0; i <= offset; i++) {
+        __u64 index = i;
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+        if (ioctl(fd, FIB_IOC_SUBMIT, &index) < 0)
+            fail("FIB_IOC_SUBMIT");
+        if (poll(&pfd, 1, 10000) != 1)
+            fail("poll");
+        if (read(fd, buf, sizeof(buf)) <= 0)
+            fail("read");
+        printf("Submit from " FIB_DEV
+               " at offset %d, returned the sequence %s.\n",
+               i, buf);
+    }
+    close(fd);
+}
+
 int main()
 {
     long long sz;
@@ -23,11 +238,7 @@ int main()
     char write_buf[] = "testing writing";
     int offset = 100; /* TODO: try test something bigger than the limit */
 
-    int fd = open(FIB_DEV, O_RDWR);
-    if (fd < 0) {
-        perror("Failed to open character device");
-        exit(1);
-    }
+    int fd = open_dev();
 
     for (int i = 0; i <= offset; i++) {
         sz = write(fd, write_buf, 999);
@@ -68,5 +279,12 @@ int main()
     }
 
     close(fd);
+
+    test_range(offset);
+    test_mmap(offset);
+    test_raw(offset);
+    test_stream(offset);
+    test_step();
+    test_submit(offset);
     return 0;
 }
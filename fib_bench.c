@@ -0,0 +1,347 @@
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/preempt.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "fib_bench.h"
+
+/* A sweep is started by writing its parameters to fibdrv/bench as key=value
+ * words, for example
+ *   echo "modes=1,5,6 start=10 end=10000000 points=25 spacing=log repeat=15" \
+ *       > /sys/kernel/debug/fibdrv/bench
+ * Keys left out take the defaults of fib_bench_parse. The write returns when
+ * the sweep is done, or fails with EINTR on a fatal signal. Reading the file
+ * then gives one CSV line per mode and index:
+ *   mode,n,repeat,min_ns,median_ns,stddev_ns
+ *
+ * Every index is computed once untimed, so that the caches it fills are warm,
+ * then repeat times on one CPU. Indices a mode does not serve are skipped.
+ */
+
+#define FIB_BENCH_MAX_POINTS 1000
+#define FIB_BENCH_MAX_REPEAT 10000
+#define FIB_BENCH_MAX_INPUT 256
+
+/* Room for one CSV line. */
+#define FIB_BENCH_LINE 96
+
+struct fib_bench_conf {
+    unsigned long modes; /* bitmap of the modes to run */
+    u64 start, end;
+    unsigned int points;
+    bool log; /* logarithmic rather than linear spacing */
+    unsigned int repeat;
+};
+
+static DEFINE_MUTEX(fib_bench_lock);
+static fib_bench_fn fib_bench_run;
+static unsigned int fib_bench_modes;
+static char *fib_bench_csv; /* results of the last sweep */
+static size_t fib_bench_len;
+
+/* Fractional bits of the fixed point logarithms placing log spaced indices. */
+#define FIB_BENCH_FRAC 16
+
+/* Return log2(x) for x > 0, rounded down to FIB_BENCH_FRAC fractional bits.
+ * The fraction comes one bit at a time from squaring the mantissa.
+ */
+static u64 fib_bench_log2(u64 x)
+{
+    const unsigned int e = ilog2(x);
+    /* x / 2^e, in [1, 2), with 31 fractional bits */
+    u64 y = e > 31 ? x >> (e - 31) : x << (31 - e);
+    u64 l = (u64) e << FIB_BENCH_FRAC;
+
+    for (int b = FIB_BENCH_FRAC - 1; b >= 0; b--) {
+        y = (y * y) >> 31;
+        if (y >= 2ULL << 31) {
+            y >>= 1;
+            l |= 1ULL << b;
+        }
+    }
+    return l;
+}
+
+/* Return the smallest x with fib_bench_log2(x) >= l. */
+static u64 fib_bench_exp2(u64 l)
+{
+    u64 lo = 1, hi = U64_MAX;
+
+    while (lo < hi) {
+        const u64 mid = lo + (hi - lo) / 2;
+        if (fib_bench_log2(mid) < l)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Return the i-th index of the sweep. */
+static u64 fib_bench_index(const struct fib_bench_conf *c, unsigned int i)
+{
+    if (i == 0)
+        return c->start;
+    if (i == c->points - 1)
+        return c->end;
+    if (!c->log)
+        return c->start + mul_u64_u32_div(c->end - c->start, i, c->points - 1);
+
+    const u64 l0 = fib_bench_log2(c->start), l1 = fib_bench_log2(c->end);
+    return fib_bench_exp2(l0 + div_u64((l1 - l0) * i, c->points - 1));
+}
+
+/* Parse a comma separated list of modes into the bitmap at modes. */
+static int fib_bench_parse_modes(char *list, unsigned long *modes)
+{
+    char *m;
+
+    *modes = 0;
+    while ((m = strsep(&list, ","))) {
+        unsigned int mode;
+        int rc = kstrtouint(m, 0, &mode);
+        if (rc)
+            return rc;
+        if (mode >= fib_bench_modes)
+            return -EINVAL;
+        __set_bit(mode, modes);
+    }
+    return 0;
+}
+
+static int fib_bench_parse(char *line, struct fib_bench_conf *c)
+{
+    char *word;
+
+    *c = (struct fib_bench_conf){
+        .modes = BIT(fib_bench_modes) - 1,
+        .start = 1,
+        .end = 1000,
+        .points = 10,
+        .log = false,
+        .repeat = 10,
+    };
+    while ((word = strsep(&line, " \t\n"))) {
+        char *val = word;
+        const char *key = strsep(&val, "=");
+        int rc = 0;
+
+        if (!*key)
+            continue;
+        if (!val)
+            return -EINVAL;
+        if (!strcmp(key, "modes"))
+            rc = fib_bench_parse_modes(val, &c->modes);
+        else if (!strcmp(key, "start"))
+            rc = kstrtou64(val, 0, &c->start);
+        else if (!strcmp(key, "end"))
+            rc = kstrtou64(val, 0, &c->end);
+        else if (!strcmp(key, "points"))
+            rc = kstrtouint(val, 0, &c->points);
+        else if (!strcmp(key, "repeat"))
+            rc = kstrtouint(val, 0, &c->repeat);
+        else if (!strcmp(key, "spacing") && !strcmp(val, "log"))
+            c->log = true;
+        else if (!strcmp(key, "spacing") && !strcmp(val, "lin"))
+            c->log = false;
+        else
+            rc = -EINVAL;
+        if (rc)
+            return rc;
+    }
+
+    if (!c->modes || c->start > c->end || (c->log && !c->start))
+        return -EINVAL;
+    if (!c->points || c->points > FIB_BENCH_MAX_POINTS)
+        return -EINVAL;
+    if (!c->repeat || c->repeat > FIB_BENCH_MAX_REPEAT)
+        return -EINVAL;
+    return 0;
+}
+
+/* Fill t[repeat] with the times of F(n) by mode. */
+static int fib_bench_sample(unsigned int mode,
+                            u64 n,
+                            unsigned int repeat,
+                            s64 *t)
+{
+    const s64 warm = fib_bench_run(mode, n);
+    if (warm < 0)
+        return warm;
+
+    for (unsigned int r = 0; r < repeat; r++) {
+        if (fatal_signal_pending(current))
+            return -EINTR;
+        cond_resched();
+
+        /* Engines may allocate or wait for workers, so samples are only
+         * pinned to this CPU here; run disables preemption for those that
+         * can take it.
+         */
+        migrate_disable();
+        t[r] = fib_bench_run(mode, n);
+        migrate_enable();
+        if (t[r] < 0)
+            return t[r];
+    }
+    return 0;
+}
+
+static int fib_bench_cmp(const void *a, const void *b)
+{
+    const s64 x = *(const s64 *) a, y = *(const s64 *) b;
+    return (x > y) - (x < y);
+}
+
+/* Print the CSV line of the samples t[repeat], which it sorts. Deviations
+ * from the mean saturate at U32_MAX ns so that their squares fit in a u64.
+ */
+static size_t fib_bench_report(char *buf,
+                               size_t size,
+                               unsigned int mode,
+                               u64 n,
+                               s64 *t,
+                               unsigned int repeat)
+{
+    const unsigned int h = repeat / 2;
+    u64 sum = 0, var = 0;
+
+    sort(t, repeat, sizeof(*t), fib_bench_cmp, NULL);
+    for (unsigned int r = 0; r < repeat; r++)
+        sum += t[r];
+
+    const u64 mean = div_u64(sum, repeat);
+    for (unsigned int r = 0; r < repeat; r++) {
+        const u64 d = min_t(u64, abs(t[r] - (s64) mean), U32_MAX);
+        var += div_u64(d * d, repeat);
+    }
+
+    const s64 median = repeat & 1 ? t[h] : (t[h - 1] + t[h]) / 2;
+    return scnprintf(buf, size, "%u,%llu,%u,%lld,%lld,%llu\n", mode, n,
+                     repeat, t[0], median, int_sqrt64(var));
+}
+
+/* Run the sweep c and return its CSV in a buffer from kvmalloc. */
+static ssize_t fib_bench_sweep(const struct fib_bench_conf *c, char **csv)
+{
+    const size_t size =
+        ((size_t) c->points * hweight_long(c->modes) + 1) * FIB_BENCH_LINE;
+    char *buf = kvmalloc(size, GFP_KERNEL);
+    s64 *t = kvmalloc_array(c->repeat, sizeof(*t), GFP_KERNEL);
+    size_t len = 0;
+    unsigned int mode;
+    int rc = 0;
+
+    if (!buf || !t) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    len = scnprintf(buf, size, "mode,n,repeat,min_ns,median_ns,stddev_ns\n");
+    for_each_set_bit (mode, &c->modes, fib_bench_modes) {
+        for (unsigned int i = 0; i < c->points; i++) {
+            const u64 n = fib_bench_index(c, i);
+
+            /* Close log spaced points round to the same index. */
+            if (i && n == fib_bench_index(c, i - 1))
+                continue;
+            rc = fib_bench_sample(mode, n, c->repeat, t);
+            if (rc == -EOVERFLOW) {
+                rc = 0;
+                continue;
+            }
+            if (rc)
+                goto out;
+            len += fib_bench_report(buf + len, size - len, mode, n, t,
+                                    c->repeat);
+        }
+    }
+
+out:
+    kvfree(t);
+    if (rc) {
+        kvfree(buf);
+        return rc;
+    }
+    *csv = buf;
+    return len;
+}
+
+static ssize_t fib_bench_write(struct file *file,
+                               const char __user *ubuf,
+                               size_t len,
+                               loff_t *ppos)
+{
+    struct fib_bench_conf conf;
+    char *line, *csv;
+    ssize_t rc;
+
+    if (len > FIB_BENCH_MAX_INPUT)
+        return -EINVAL;
+    line = memdup_user_nul(ubuf, len);
+    if (IS_ERR(line))
+        return PTR_ERR(line);
+    rc = fib_bench_parse(line, &conf);
+    kfree(line);
+    if (rc)
+        return rc;
+
+    if (mutex_lock_interruptible(&fib_bench_lock))
+        return -EINTR;
+    rc = fib_bench_sweep(&conf, &csv);
+    if (rc >= 0) {
+        kvfree(fib_bench_csv);
+        fib_bench_csv = csv;
+        fib_bench_len = rc;
+        rc = len;
+    }
+    mutex_unlock(&fib_bench_lock);
+    return rc;
+}
+
+static ssize_t fib_bench_read(struct file *file,
+                              char __user *ubuf,
+                              size_t len,
+                              loff_t *ppos)
+{
+    ssize_t rc;
+
+    if (mutex_lock_interruptible(&fib_bench_lock))
+        return -EINTR;
+    rc = simple_read_from_buffer(ubuf, len, ppos, fib_bench_csv,
+                                 fib_bench_len);
+    mutex_unlock(&fib_bench_lock);
+    return rc;
+}
+
+static const struct file_operations fib_bench_fops = {
+    .owner = THIS_MODULE,
+    .read = fib_bench_read,
+    .write = fib_bench_write,
+    .llseek = default_llseek,
+};
+
+void fib_bench_init(struct dentry *dir, unsigned int modes, fib_bench_fn run)
+{
+    fib_bench_modes = min_t(unsigned int, modes, BITS_PER_LONG);
+    fib_bench_run = run;
+    debugfs_create_file("bench", 0600, dir, NULL, &fib_bench_fops);
+}
+
+void fib_bench_exit(void)
+{
+    kvfree(fib_bench_csv);
+    fib_bench_csv = NULL;
+    fib_bench_len = 0;
+}
@@ -0,0 +1,20 @@
+/* Benchmark sweep of the write() engines, driven from debugfs. */
+
+#ifndef _FIB_BENCH_H_
+#define _FIB_BENCH_H_
+
+#include <linux/types.h>
+
+struct dentry;
+
+/* Return the time in ns of one computation of F(n) by write() mode, or a
+ * negative errno if the mode does not serve n. It is called in process
+ * context, with migration disabled while samples are taken.
+ */
+typedef s64 (*fib_bench_fn)(unsigned int mode, u64 n);
+
+/* Create fibdrv/bench in dir for modes [0, modes) of run. */
+void fib_bench_init(struct dentry *dir, unsigned int modes, fib_bench_fn run);
+void fib_bench_exit(void);
+
+#endif /* !_FIB_BENCH_H_ */
@@ -0,0 +1,222 @@
+#include <linux/hashtable.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+
+#include "fib_cache.h"
+
+/* Entries are found through an RCU hash table, so lookups never take a lock.
+ * Insertion, eviction and the LRU list are serialized by fib_cache_lock.
+ *
+ * Recency is tracked with the CLOCK approximation of LRU: a hit only sets
+ * referenced, and eviction walks the list from its oldest end, giving
+ * referenced entries a second chance at the tail instead of evicting them.
+ * An entry is freed after an RCU grace period once both the table and every
+ * reader copying it out have dropped their reference.
+ */
+struct fib_cache_entry {
+    struct hlist_node node; /* in fib_cache_table */
+    struct list_head lru;   /* in fib_cache_lru */
+    struct rcu_head rcu;
+    refcount_t ref;
+    bool referenced;
+    uint64_t n;
+    size_t bytes; /* memory charged to the budget */
+    bn_t prev, fib; /* F(n - 1), F(n) */
+};
+
+#define FIB_CACHE_HASH_BITS 10
+
+static DEFINE_HASHTABLE(fib_cache_table, FIB_CACHE_HASH_BITS);
+static LIST_HEAD(fib_cache_lru);
+static DEFINE_SPINLOCK(fib_cache_lock);
+static unsigned long fib_cache_count;
+static size_t fib_cache_used;
+
+static atomic_long_t fib_cache_hits;
+static atomic_long_t fib_cache_misses;
+
+static unsigned long cache_bytes = 16 << 20;
+module_param(cache_bytes, ulong, 0644);
+MODULE_PARM_DESC(cache_bytes, "Memory budget of the result cache in bytes");
+
+static int fib_cache_stats_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "hits %ld misses %ld entries %lu bytes %zu\n",
+                   atomic_long_read(&fib_cache_hits),
+                   atomic_long_read(&fib_cache_misses), fib_cache_count,
+                   fib_cache_used);
+}
+
+static const struct kernel_param_ops fib_cache_stats_ops = {
+    .get = fib_cache_stats_get,
+};
+module_param_cb(cache_stats, &fib_cache_stats_ops, NULL, 0444);
+MODULE_PARM_DESC(cache_stats, "Result cache hits, misses and occupancy");
+
+static void fib_cache_free_rcu(struct rcu_head *rcu)
+{
+    struct fib_cache_entry *e = container_of(rcu, struct fib_cache_entry, rcu);
+
+    bn_free(e->prev);
+    bn_free(e->fib);
+    kfree(e);
+}
+
+static void fib_cache_entry_put(struct fib_cache_entry *e)
+{
+    if (refcount_dec_and_test(&e->ref))
+        call_rcu(&e->rcu, fib_cache_free_rcu);
+}
+
+/* Unlink e and drop the reference held by the table. */
+static void fib_cache_remove(struct fib_cache_entry *e)
+{
+    hash_del_rcu(&e->node);
+    list_del(&e->lru);
+    fib_cache_count--;
+    fib_cache_used -= e->bytes;
+    fib_cache_entry_put(e);
+}
+
+/* Evict entries until at most limit bytes are in use or nr_to_scan entries
+ * were looked at, and return the number evicted. Called with the lock held.
+ */
+static unsigned long fib_cache_evict(size_t limit, unsigned long nr_to_scan)
+{
+    unsigned long freed = 0;
+
+    while (fib_cache_used > limit && nr_to_scan--) {
+        struct fib_cache_entry *e =
+            list_first_entry(&fib_cache_lru, struct fib_cache_entry, lru);
+        if (READ_ONCE(e->referenced)) {
+            WRITE_ONCE(e->referenced, false);
+            list_move_tail(&e->lru, &fib_cache_lru);
+            continue;
+        }
+        fib_cache_remove(e);
+        freed++;
+    }
+    return freed;
+}
+
+bool fib_cache_get(uint64_t n, bn *prev, bn *fib)
+{
+    struct fib_cache_entry *e, *found = NULL;
+
+    rcu_read_lock();
+    hash_for_each_possible_rcu(fib_cache_table, e, node, n)
+    {
+        if (e->n == n && refcount_inc_not_zero(&e->ref)) {
+            found = e;
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    if (!found) {
+        atomic_long_inc(&fib_cache_misses);
+        return false;
+    }
+
+    /* The reference keeps the entry alive while copying, which may sleep. */
+    WRITE_ONCE(found->referenced, true);
+    bn_set(prev, found->prev);
+    bn_set(fib, found->fib);
+    fib_cache_entry_put(found);
+    atomic_long_inc(&fib_cache_hits);
+    return true;
+}
+
+void fib_cache_put(uint64_t n, const bn *prev, const bn *fib)
+{
+    size_t limit = READ_ONCE(cache_bytes);
+    size_t bytes = sizeof(struct fib_cache_entry) +
+                   ((size_t) prev->size + fib->size) * APM_DIGIT_SIZE;
+    if (bytes > limit)
+        return;
+
+    struct fib_cache_entry *e = kmalloc(sizeof(*e), GFP_KERNEL);
+    if (!e)
+        return;
+    bn_init(e->prev);
+    bn_init(e->fib);
+    bn_set(e->prev, prev);
+    bn_set(e->fib, fib);
+    e->n = n;
+    e->bytes = sizeof(*e) +
+               ((size_t) e->prev->alloc + e->fib->alloc) * APM_DIGIT_SIZE;
+    e->referenced = false;
+    refcount_set(&e->ref, 1);
+
+    struct fib_cache_entry *old;
+    spin_lock(&fib_cache_lock);
+    hash_for_each_possible(fib_cache_table, old, node, n)
+    {
+        if (old->n == n) { /* Another session got there first. */
+            spin_unlock(&fib_cache_lock);
+            bn_free(e->prev);
+            bn_free(e->fib);
+            kfree(e);
+            return;
+        }
+    }
+    hash_add_rcu(fib_cache_table, &e->node, n);
+    list_add_tail(&e->lru, &fib_cache_lru);
+    fib_cache_count++;
+    fib_cache_used += e->bytes;
+    fib_cache_evict(limit, ULONG_MAX);
+    spin_unlock(&fib_cache_lock);
+}
+
+static unsigned long fib_cache_shrink_count(struct shrinker *shrink,
+                                            struct shrink_control *sc)
+{
+    unsigned long count = READ_ONCE(fib_cache_count);
+    return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long fib_cache_shrink_scan(struct shrinker *shrink,
+                                           struct shrink_control *sc)
+{
+    unsigned long freed;
+
+    spin_lock(&fib_cache_lock);
+    freed = fib_cache_evict(0, sc->nr_to_scan);
+    spin_unlock(&fib_cache_lock);
+    return freed;
+}
+
+static struct shrinker fib_cache_shrinker = {
+    .count_objects = fib_cache_shrink_count,
+    .scan_objects = fib_cache_shrink_scan,
+    .seeks = DEFAULT_SEEKS,
+};
+
+int fib_cache_init(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    return register_shrinker(&fib_cache_shrinker, "fibdrv-cache");
+#else
+    return register_shrinker(&fib_cache_shrinker);
+#endif
+}
+
+void fib_cache_exit(void)
+{
+    unregister_shrinker(&fib_cache_shrinker);
+
+    spin_lock(&fib_cache_lock);
+    while (!list_empty(&fib_cache_lru))
+        fib_cache_remove(
+            list_first_entry(&fib_cache_lru, struct fib_cache_entry, lru));
+    spin_unlock(&fib_cache_lock);
+
+    /* Wait for the pending frees before the module text goes away. */
+    rcu_barrier();
+}
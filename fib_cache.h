@@ -0,0 +1,23 @@
+/* Memoization cache of computed Fibonacci numbers shared by all sessions.
+ * Each entry keeps the pair F(n - 1), F(n), so that a session restoring it
+ * can step to neighbouring indices at once. */
+
+#ifndef _FIB_CACHE_H_
+#define _FIB_CACHE_H_
+
+#include <linux/types.h>
+
+#include "bn.h"
+
+int fib_cache_init(void);
+void fib_cache_exit(void);
+
+/* Copy the cached F(n - 1) and F(n) to prev and fib and return true, or
+ * return false on a miss. */
+bool fib_cache_get(uint64_t n, bn *prev, bn *fib);
+
+/* Offer F(n - 1) and F(n) to the cache, which keeps a copy if it fits in the
+ * budget. */
+void fib_cache_put(uint64_t n, const bn *prev, const bn *fib);
+
+#endif /* !_FIB_CACHE_H_ */
@@ -0,0 +1,205 @@
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+#include "fib_stats.h"
+#include "memory.h"
+
+/* Latencies are counted in buckets by the position of their top bit, so
+ * bucket b holds requests that took [2^b, 2^(b + 1)) nanoseconds.
+ */
+#define FIB_STAT_BUCKETS 64
+
+struct fib_stat {
+    u64 requests;
+    u64 bytes;
+    u64 hist[FIB_STAT_BUCKETS];
+};
+
+/* Every CPU counts its own requests, and readers add them up, so recording
+ * a request never touches a cache line shared with another CPU.
+ */
+struct fib_stats_cpu {
+    struct fib_stat engine[FIB_STAT_ENGINES];
+};
+static DEFINE_PER_CPU(struct fib_stats_cpu, fib_stats);
+
+static struct dentry *fib_stats_dir;
+
+static const char *const fib_stat_names[FIB_STAT_ENGINES] = {
+    [FIB_STAT_WRITE + 0] = "write0",
+    [FIB_STAT_WRITE + 1] = "write1",
+    [FIB_STAT_WRITE + 2] = "write2",
+    [FIB_STAT_WRITE + 3] = "write3",
+    [FIB_STAT_WRITE + 4] = "write4",
+    [FIB_STAT_WRITE + 5] = "write5",
+    [FIB_STAT_WRITE + 6] = "write6",
+    [FIB_STAT_WRITE + 7] = "write7",
+    [FIB_STAT_READ_SEQ] = "read_seq",
+    [FIB_STAT_READ_MYBN] = "read_mybn",
+    [FIB_STAT_READ_BN] = "read_bn",
+    [FIB_STAT_READ_DEC] = "read_dec",
+    [FIB_STAT_READ_RAW] = "read_raw",
+    [FIB_STAT_COMPUTE] = "compute",
+    [FIB_STAT_RANGE] = "range",
+};
+
+void fib_stat_record(enum fib_stat_engine engine, u64 start, size_t bytes)
+{
+    const u64 ns = ktime_get_ns() - start;
+    const unsigned int b = ns ? ilog2(ns) : 0;
+    struct fib_stat *st = &get_cpu_ptr(&fib_stats)->engine[engine];
+
+    st->requests++;
+    st->bytes += bytes;
+    st->hist[b]++;
+    put_cpu_ptr(&fib_stats);
+}
+
+/* Sum the counters of engine over all CPUs into st. */
+static void fib_stat_sum(enum fib_stat_engine engine, struct fib_stat *st)
+{
+    int cpu;
+
+    memset(st, 0, sizeof(*st));
+    for_each_possible_cpu (cpu) {
+        const struct fib_stat *c =
+            &per_cpu_ptr(&fib_stats, cpu)->engine[engine];
+        st->requests += c->requests;
+        st->bytes += c->bytes;
+        for (unsigned int b = 0; b < FIB_STAT_BUCKETS; b++)
+            st->hist[b] += c->hist[b];
+    }
+}
+
+/* Return the upper bound of the bucket holding the q-th per mille of st. */
+static u64 fib_stat_quantile(const struct fib_stat *st, unsigned int q)
+{
+    const u64 rank = div_u64(st->requests * q + 999, 1000);
+    u64 seen = 0;
+
+    for (unsigned int b = 0; b < FIB_STAT_BUCKETS - 1; b++) {
+        seen += st->hist[b];
+        if (seen >= rank)
+            return (2ULL << b) - 1;
+    }
+    return U64_MAX;
+}
+
+static int fib_requests_show(struct seq_file *m, void *v)
+{
+    struct fib_stat st;
+
+    seq_printf(m, "%-10s %12s %16s\n", "engine", "requests", "bytes");
+    for (unsigned int e = 0; e < FIB_STAT_ENGINES; e++) {
+        fib_stat_sum(e, &st);
+        seq_printf(m, "%-10s %12llu %16llu\n", fib_stat_names[e], st.requests,
+                   st.bytes);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fib_requests);
+
+static int fib_latency_show(struct seq_file *m, void *v)
+{
+    struct fib_stat st;
+
+    seq_printf(m, "%-10s %12s %14s %14s %14s\n", "engine", "requests",
+               "p50_ns", "p99_ns", "p999_ns");
+    for (unsigned int e = 0; e < FIB_STAT_ENGINES; e++) {
+        fib_stat_sum(e, &st);
+        if (!st.requests)
+            continue;
+        seq_printf(m, "%-10s %12llu %14llu %14llu %14llu\n", fib_stat_names[e],
+                   st.requests, fib_stat_quantile(&st, 500),
+                   fib_stat_quantile(&st, 990), fib_stat_quantile(&st, 999));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fib_latency);
+
+/* One line per engine and non-empty bucket: the bucket's lower bound in ns
+ * and its count. */
+static int fib_histogram_show(struct seq_file *m, void *v)
+{
+    struct fib_stat st;
+
+    for (unsigned int e = 0; e < FIB_STAT_ENGINES; e++) {
+        fib_stat_sum(e, &st);
+        for (unsigned int b = 0; b < FIB_STAT_BUCKETS; b++) {
+            if (st.hist[b])
+                seq_printf(m, "%s %llu %llu\n", fib_stat_names[e],
+                           b ? 1ULL << b : 0, st.hist[b]);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fib_histogram);
+
+static int fib_alloc_show(struct seq_file *m, void *v)
+{
+    struct xmem_stats st;
+
+    xmem_get_stats(&st);
+    seq_printf(m, "allocs %llu\n", st.allocs);
+    seq_printf(m, "frees %llu\n", st.frees);
+    seq_printf(m, "reallocs %llu\n", st.reallocs);
+    seq_printf(m, "reallocs_in_place %llu\n", st.realloc_ip);
+    seq_printf(m, "cache_hits %llu\n", st.cache_hits);
+    seq_printf(m, "slab_allocs %llu\n", st.slab_allocs);
+    seq_printf(m, "slab_frees %llu\n", st.slab_frees);
+    seq_printf(m, "large %llu\n", st.large);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fib_alloc);
+
+/* Any write to reset zeroes every counter. Requests in flight on other CPUs
+ * may still land in the old counts.
+ */
+static ssize_t fib_reset_write(struct file *file,
+                               const char __user *buf,
+                               size_t len,
+                               loff_t *ppos)
+{
+    int cpu;
+
+    for_each_possible_cpu (cpu)
+        memset(per_cpu_ptr(&fib_stats, cpu), 0,
+               sizeof(struct fib_stats_cpu));
+    xmem_reset_stats();
+    return len;
+}
+
+static const struct file_operations fib_reset_fops = {
+    .owner = THIS_MODULE,
+    .write = fib_reset_write,
+};
+
+struct dentry *fib_stats_debugfs(void)
+{
+    return fib_stats_dir;
+}
+
+int fib_stats_init(void)
+{
+    /* Statistics are optional, so debugfs errors are not fatal. */
+    fib_stats_dir = debugfs_create_dir("fibdrv", NULL);
+    debugfs_create_file("requests", 0444, fib_stats_dir, NULL,
+                        &fib_requests_fops);
+    debugfs_create_file("latency", 0444, fib_stats_dir, NULL,
+                        &fib_latency_fops);
+    debugfs_create_file("histogram", 0444, fib_stats_dir, NULL,
+                        &fib_histogram_fops);
+    debugfs_create_file("alloc", 0444, fib_stats_dir, NULL, &fib_alloc_fops);
+    debugfs_create_file("reset", 0200, fib_stats_dir, NULL, &fib_reset_fops);
+    return 0;
+}
+
+void fib_stats_exit(void)
+{
+    debugfs_remove_recursive(fib_stats_dir);
+    fib_stats_dir = NULL;
+}
@@ -0,0 +1,36 @@
+/* Request statistics of the driver, exposed in debugfs under fibdrv/. */
+
+#ifndef _FIB_STATS_H_
+#define _FIB_STATS_H_
+
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+/* The ways a request reaches an engine. */
+enum fib_stat_engine {
+    FIB_STAT_WRITE, /* write(), FIB_STAT_WRITE + mode */
+    FIB_STAT_READ_SEQ = FIB_STAT_WRITE + 8, /* legacy read, size 0 */
+    FIB_STAT_READ_MYBN, /* legacy read, size 1 */
+    FIB_STAT_READ_BN,   /* legacy read, size 2 */
+    FIB_STAT_READ_DEC,  /* read in FIB_FMT_DEC */
+    FIB_STAT_READ_RAW,  /* read in FIB_FMT_RAW */
+    FIB_STAT_COMPUTE,   /* FIB_IOC_COMPUTE */
+    FIB_STAT_RANGE,     /* FIB_IOC_RANGE */
+    FIB_STAT_ENGINES,
+};
+
+/* Number of write() modes. */
+#define FIB_STAT_WRITE_MODES (FIB_STAT_READ_SEQ - FIB_STAT_WRITE)
+
+/* Count a request to engine that started at start, as given by
+ * ktime_get_ns(), and copied bytes to user space.
+ */
+void fib_stat_record(enum fib_stat_engine engine, u64 start, size_t bytes);
+
+/* The debugfs directory of the driver, or an error pointer. */
+struct dentry *fib_stats_debugfs(void);
+
+int fib_stats_init(void);
+void fib_stats_exit(void);
+
+#endif /* !_FIB_STATS_H_ */
@@ -4,13 +4,28 @@
 #include <linux/init.h>
 #include <linux/kdev_t.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/preempt.h>
+#include <linux/sched/signal.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "bn.h"
+#include "fib_bench.h"
+#include "fib_cache.h"
+#include "fib_stats.h"
+#include "fibdrv.h"
 #include "fibonacci.h"
 #include "mybignum.h"
 
+#define CREATE_TRACE_POINTS
+#include "fibdrv_trace.h"
+
 
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_AUTHOR("National Cheng Kung University, Taiwan");
@@ -19,10 +34,28 @@ MODULE_VERSION("0.1");
 
 #define DEV_FIBONACCI_NAME "fibonacci"
 
-/* MAX_LENGTH is set to 92 because
- * ssize_t can't fit the number > 92
+/* MAX_LENGTH is the largest index served. F(n) has about n * log2(phi)
+ * = n / 1.4404 bits, which this keeps below 2^20 limbs (8 MiB). The last
+ * doubling step multiplies halves of that, whose NTT takes 36 bytes per limb
+ * of a transform up to twice the product: 72 MiB, well inside the INT_MAX
+ * bytes kvmalloc serves, so the multiplication never falls back on Toom-3.
+ * With the three products of a parallel step and the decimal string, one
+ * open file still holds only a few hundred MiB.
+ */
+#define MAX_LENGTH ((1LL << 20) * APM_DIGIT_BITS / 1000 * 1440)
+
+/* The legacy read mode returning F(k) itself is limited to 92, because
+ * ssize_t can't fit the number > 92.
+ */
+#define MAX_SEQUENCE_LENGTH 92
+
+/* The iterative bignum engines take time quadratic in the index, and the
+ * decimal fast doubling multiplies by Karatsuba at best. None of them ever
+ * reschedules, so they stop far below MAX_LENGTH, where a call still takes
+ * well under a second.
  */
-#define MAX_LENGTH 500
+#define MAX_ITER_LENGTH 100000
+#define MAX_DEC_LENGTH 1000000
 
 #define TIME_PROXY(fib_f, result, k, timer)             \
     ({                                                  \
@@ -38,18 +71,68 @@ MODULE_VERSION("0.1");
         timer = (size_t) ktime_sub(ktime_get(), timer); \
     });
 
+/* BN_TIME_PROXY for the mybignum engines, which can fail. */
+#define MY_BN_TIME_PROXY(fib_f, result, k, timer, rc)   \
+    ({                                                  \
+        timer = ktime_get();                            \
+        rc = fib_f(*offset, result);                    \
+        timer = (size_t) ktime_sub(ktime_get(), timer); \
+    });
+
+/* read format of a session that never issued FIB_IOC_SET_FORMAT */
+#define FIB_FMT_LEGACY -1
+
 static dev_t fib_dev = 0;
 static struct cdev *fib_cdev;
 static struct class *fib_class;
 
-#define MUTEX
-
-#ifdef MUTEX
-static DEFINE_MUTEX(fib_mutex);
-#endif
-
-// the timer to caculate lernel fib runtime
-static ktime_t timer;
+/* Per-open state. Every file descriptor computes on its own buffers, so
+ * separate opens never contend with each other; the mutex only serializes
+ * threads sharing one descriptor. The index is file->f_pos, which is already
+ * per-open.
+ *
+ * map is the page-backed region shared with user space through mmap. It is
+ * created once and lives until release, so map_lock only guards its creation;
+ * fib_mmap runs under mmap_lock and must not wait on lock, which is held
+ * across copy_to_user.
+ *
+ * format is FIB_FMT_LEGACY until FIB_IOC_SET_FORMAT picks an output format
+ * for read; in legacy mode the size argument of read selects the engine.
+ *
+ * The last result is cached: fib holds F(index) unless index is -1, and buf
+ * its decimal form when len is non-zero. Successive reads of one index
+ * continue at pos, like a regular file, until they return 0 at the end. A
+ * seek to another index drops the decimal form.
+ *
+ * When has_prev is set, prev holds F(index - 1) as well, so that a scan to a
+ * neighbouring index costs one addition or subtraction per step instead of a
+ * full fast doubling run.
+ *
+ * FIB_IOC_SUBMIT hands an index to work and returns at once; busy stays set
+ * until work has computed it into the cache above, then wait is woken. The
+ * ioctl does not hold f_pos_lock, so it leaves the index in next for the
+ * following read to move the file offset to.
+ */
+struct fib_session {
+    struct mutex lock;
+    int format;      /* FIB_FMT_* used by read */
+    bn_t fib;        /* F(index), or scratch for the bn engines */
+    bn_t prev;       /* F(index - 1) if has_prev */
+    loff_t index;    /* index cached in fib, -1 if none */
+    bool has_prev;   /* prev is valid */
+    char *buf;       /* output buffer for formatted results */
+    size_t buf_size; /* allocated size of buf */
+    size_t len;      /* length of the decimal F(index) in buf, 0 if none */
+    size_t pos;      /* read position in the formatted F(index) */
+    struct mutex map_lock;
+    void *map;       /* region exposed by fib_mmap */
+    size_t map_size; /* size of map */
+    struct work_struct work;
+    wait_queue_head_t wait;
+    loff_t job;      /* index submitted to work */
+    bool busy;       /* work has not finished job yet */
+    loff_t next;     /* index the next read moves to, -1 if none */
+};
 
 static void escape(void *p)
 {
@@ -68,7 +151,7 @@ static long long fib_sequence(long long k)
     a = 0;
     b = 1;
 
-    for (int i = 2; i <= k; i++) {
+    for (long long i = 2; i <= k; i++) {
         unsigned long long temp = a + b;
         a = b;
         b = temp;
@@ -150,61 +233,479 @@ static long long fib_clz_fastdoubling(long long k)
     return a;
 }
 
-static int fib_open(struct inode *inode, struct file *file)
+/* Return the session output buffer, grown to at least size bytes. Every
+ * caller rewrites it, so growing it does not keep the old contents.
+ */
+static char *fib_session_buf(struct fib_session *s, size_t size)
 {
-#ifdef MUTEX
-    if (!mutex_trylock(&fib_mutex)) {
-        printk(KERN_ALERT "fibdrv is in use");
-        return -EBUSY;
+    if (s->buf_size < size) {
+        /* A large result outgrows what kmalloc can hand out. */
+        char *p = kvmalloc(size, GFP_KERNEL);
+        if (!p)
+            return NULL;
+        kvfree(s->buf);
+        s->buf = p;
+        s->buf_size = size;
+    }
+    return s->buf;
+}
+
+/* Forget the cached result, e.g. after fib was used as scratch. */
+static void fib_session_invalidate(struct fib_session *s)
+{
+    s->index = -1;
+    s->has_prev = false;
+    s->len = 0;
+    s->pos = 0;
+}
+
+/* Farthest index fib_session_compute derives from the cached pair. */
+#define FIB_NEIGHBOUR_STEPS 2
+
+/* Move the cached pair (F(index - 1), F(index)) one index up or down. */
+static void fib_session_step(struct fib_session *s, bool up)
+{
+    if (up) {
+        bn_add(s->prev, s->fib, s->prev); /* F(index + 1) */
+        bn_swap(s->prev, s->fib);
+        s->index++;
+    } else {
+        bn_sub(s->fib, s->prev, s->fib); /* F(index - 2) */
+        bn_swap(s->prev, s->fib);
+        s->index--;
+    }
+}
+
+/* Set prev and fib to F(n - 1) and F(n), taken from the shared result cache
+ * if present there and computed otherwise. Return 0 or -EINTR.
+ */
+static int fib_lookup_pair(loff_t n, bn *prev, bn *fib, int engine)
+{
+    if (fib_cache_get(n, prev, fib)) {
+        trace_fib_lookup(n, engine, fib->size, 0);
+        return 0;
+    }
+    trace_fib_lookup(n, engine, 0, 0);
+    const int rc = ref_fd_fibonacci_pair(n, prev, fib);
+    if (rc)
+        return rc;
+    trace_fib_compute(n, engine, fib->size, 0);
+    fib_cache_put(n, prev, fib);
+    return 0;
+}
+
+/* Make s->fib hold F(n). It is derived from the cached pair when n is a
+ * neighbour of the cached index, taken from the shared result cache if
+ * present there, and computed otherwise. Return 0, or -EINTR if the task
+ * was killed meanwhile, leaving nothing cached.
+ */
+static int fib_session_compute(struct fib_session *s, loff_t n, int engine)
+{
+    if (s->index == n) {
+        trace_fib_lookup(n, engine, s->fib->size, 0);
+        return 0;
+    }
+
+    if (s->has_prev && n >= s->index - FIB_NEIGHBOUR_STEPS &&
+        n <= s->index + FIB_NEIGHBOUR_STEPS) {
+        trace_fib_lookup(n, engine, 0, 0);
+        s->len = 0;
+        s->pos = 0;
+        while (s->index != n)
+            fib_session_step(s, n > s->index);
+        trace_fib_compute(n, engine, s->fib->size, 0);
+        return 0;
+    }
+
+    fib_session_invalidate(s);
+    const int rc = fib_lookup_pair(n, s->prev, s->fib, engine);
+    if (rc)
+        return rc;
+    s->has_prev = true;
+    s->index = n;
+    return 0;
+}
+
+/* Convert the cached F(index) to decimal in s->buf, unless it already is.
+ * Return its length, '\0' included, or a negative error code.
+ */
+static ssize_t fib_session_dec(struct fib_session *s, int engine)
+{
+    if (!s->len) {
+        char *p = fib_session_buf(s, bn_sprint_size(s->fib, 10));
+        if (!p)
+            return -ENOMEM;
+        s->len = bn_sprint(s->fib, 10, p) + 1;
+        trace_fib_format(s->index, engine, s->fib->size, s->len);
+    }
+    return s->len;
+}
+
+/* The engine, for statistics and tracing, of a read in the session format. */
+static int fib_read_engine(const struct fib_session *s)
+{
+    switch (s->format) {
+    case FIB_FMT_DEC:
+        return FIB_STAT_READ_DEC;
+    case FIB_FMT_RAW:
+        return FIB_STAT_READ_RAW;
+    }
+    return FIB_STAT_READ_BN;
+}
+
+/* Compute a submitted index, and convert it ahead of the read collecting it
+ * if that read will want decimal. Both are done in numbers and a buffer of
+ * the job's own, without s->lock, which is only taken to publish them, so
+ * the session stays responsive meanwhile.
+ */
+static void fib_session_work(struct work_struct *work)
+{
+    struct fib_session *s = container_of(work, struct fib_session, work);
+    const loff_t n = s->job;
+    const int engine = fib_read_engine(s);
+    char *buf = NULL;
+    size_t buf_size = 0, len = 0;
+    bn_t prev, fib;
+
+    bn_init(prev);
+    bn_init(fib);
+    const int rc = fib_lookup_pair(n, prev, fib, engine);
+    if (!rc && engine != FIB_STAT_READ_RAW) {
+        buf_size = bn_sprint_size(fib, 10);
+        buf = kvmalloc(buf_size, GFP_KERNEL);
+        if (buf) {
+            len = bn_sprint(fib, 10, buf) + 1;
+            trace_fib_format(n, engine, fib->size, len);
+        }
+    }
+
+    mutex_lock(&s->lock);
+    if (!rc) {
+        bn_swap(s->prev, prev);
+        bn_swap(s->fib, fib);
+        s->index = n;
+        s->has_prev = true;
+        s->len = 0;
+        s->pos = 0;
+        if (buf) {
+            swap(s->buf, buf);
+            s->buf_size = buf_size;
+            s->len = len;
+        }
+    }
+    WRITE_ONCE(s->busy, false);
+    mutex_unlock(&s->lock);
+    wake_up_interruptible(&s->wait);
+
+    kvfree(buf); /* the buffer replaced, if any */
+    bn_free(prev);
+    bn_free(fib);
+}
+
+/* Wait for a submitted computation, unless the file is non-blocking. */
+static int fib_session_wait(struct fib_session *s, struct file *file)
+{
+    if (!READ_ONCE(s->busy))
+        return 0;
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+    return wait_event_interruptible(s->wait, !READ_ONCE(s->busy));
+}
+
+/* Move the offset of a read to the index last submitted, if any. */
+static int fib_session_seek_next(struct fib_session *s, loff_t *offset)
+{
+    if (mutex_lock_interruptible(&s->lock))
+        return -EINTR;
+    if (s->next >= 0) {
+        *offset = s->next;
+        s->next = -1;
     }
-#endif
+    mutex_unlock(&s->lock);
+    return 0;
+}
+
+static int fib_open(struct inode *inode, struct file *file)
+{
+    struct fib_session *s = kzalloc(sizeof(*s), GFP_KERNEL);
+    if (!s)
+        return -ENOMEM;
+
+    mutex_init(&s->lock);
+    mutex_init(&s->map_lock);
+    s->format = FIB_FMT_LEGACY;
+    bn_init(s->fib);
+    bn_init(s->prev);
+    fib_session_invalidate(s);
+    s->next = -1;
+    INIT_WORK(&s->work, fib_session_work);
+    init_waitqueue_head(&s->wait);
+    file->private_data = s;
     return 0;
 }
 
 static int fib_release(struct inode *inode, struct file *file)
 {
-#ifdef MUTEX
-    mutex_unlock(&fib_mutex);
-#endif
+    struct fib_session *s = file->private_data;
+
+    cancel_work_sync(&s->work);
+    bn_free(s->fib);
+    bn_free(s->prev);
+    kvfree(s->buf);
+    vfree(s->map);
+    mutex_destroy(&s->map_lock);
+    mutex_destroy(&s->lock);
+    kfree(s);
+    return 0;
+}
+
+/* Size of fib in FIB_FMT_RAW form. */
+static size_t fib_raw_size(const bn *fib)
+{
+    return sizeof(struct fib_raw_header) + (size_t) fib->size * APM_DIGIT_SIZE;
+}
+
+/* Copy at most size bytes of fib in FIB_FMT_RAW form, starting at byte pos,
+ * to buf, straight from its limbs. Return the number of bytes copied or a
+ * negative error code.
+ */
+static ssize_t fib_copy_raw(char __user *buf,
+                            size_t size,
+                            const bn *fib,
+                            size_t pos)
+{
+    struct fib_raw_header hdr = {
+        .digit_size = APM_DIGIT_SIZE,
+        .size = fib->size,
+    };
+    size_t total = fib_raw_size(fib);
+    size_t n = 0;
+
+    if (pos >= total)
+        return 0;
+    size = min(size, total - pos);
+    if (pos < sizeof(hdr)) {
+        n = min(size, sizeof(hdr) - pos);
+        if (copy_to_user(buf, (char *) &hdr + pos, n))
+            return -EFAULT;
+        pos += n;
+    }
+    if (copy_to_user(buf + n, (char *) fib->digits + pos - sizeof(hdr),
+                     size - n))
+        return -EFAULT;
+    return size;
+}
+
+/* Decimal results that are not kept in the session are streamed to user
+ * space through a chunk of this many bytes of the session buffer.
+ */
+#define FIB_CHUNK_SIZE 4096
+
+struct fib_user_sink {
+    struct apm_sink sk;
+    char __user *buf; /* where the next chunk goes */
+};
+
+static int fib_user_flush(struct apm_sink *sk)
+{
+    struct fib_user_sink *us = container_of(sk, struct fib_user_sink, sk);
+
+    if (copy_to_user(us->buf, sk->buf, sk->len))
+        return -EFAULT;
+    us->buf += sk->len;
+    return 0;
+}
+
+/* Store fib in dst, which holds size bytes, in the given FIB_FMT_* format.
+ * Return the number of bytes used, or the negated size needed if dst is too
+ * small.
+ */
+static ssize_t fib_format(const bn *fib, int format, void *dst, size_t size)
+{
+    size_t need;
+
+    switch (format) {
+    case FIB_FMT_DEC:
+        need = bn_sprint_size(fib, 10);
+        if (size < need)
+            return -(ssize_t) need;
+        return bn_sprint(fib, 10, dst) + 1;
+    case FIB_FMT_RAW: {
+        struct fib_raw_header hdr = {
+            .digit_size = APM_DIGIT_SIZE,
+            .size = fib->size,
+        };
+        need = fib_raw_size(fib);
+        if (size < need)
+            return -(ssize_t) need;
+        memcpy(dst, &hdr, sizeof(hdr));
+        memcpy(dst + sizeof(hdr), fib->digits, need - sizeof(hdr));
+        return need;
+    }
+    }
     return 0;
 }
 
+/* Read the next chunk of F(*offset) in the format chosen with
+ * FIB_IOC_SET_FORMAT; size is the length of buf. The result is computed and
+ * converted once, then handed out over as many reads as buf needs. Return the
+ * number of bytes copied, 0 once all of it has been read.
+ */
+static ssize_t fib_read_format(struct fib_session *s,
+                               char __user *buf,
+                               size_t size,
+                               loff_t *offset)
+{
+    const int engine = fib_read_engine(s);
+    ssize_t rc;
+
+    if (mutex_lock_interruptible(&s->lock))
+        return -EINTR;
+
+    rc = fib_session_compute(s, *offset, engine);
+    if (rc)
+        goto unlock;
+    if (s->format == FIB_FMT_RAW) {
+        rc = fib_copy_raw(buf, size, s->fib, s->pos);
+    } else {
+        rc = fib_session_dec(s, engine);
+        if (rc > 0) {
+            rc = min(size, s->len - s->pos);
+            if (copy_to_user(buf, s->buf + s->pos, rc))
+                rc = -EFAULT;
+        }
+    }
+    if (rc > 0) {
+        s->pos += rc;
+        trace_fib_copy(*offset, engine, s->fib->size, rc);
+    }
+
+unlock:
+    mutex_unlock(&s->lock);
+    return rc;
+}
+
 /* calculate the fibonacci number at given offset */
 static ssize_t fib_read(struct file *file,
                         char *buf,
                         size_t size,
                         loff_t *offset)
 {
+    struct fib_session *s = file->private_data;
+    const u64 start = ktime_get_ns();
+
+    int rc = fib_session_wait(s, file);
+    if (!rc)
+        rc = fib_session_seek_next(s, offset);
+    if (rc)
+        return rc;
+    if (*offset > MAX_LENGTH)
+        return -EOVERFLOW;
+
+    if (s->format != FIB_FMT_LEGACY) {
+        trace_fib_request(*offset, fib_read_engine(s), 0, size);
+        ssize_t n = fib_read_format(s, buf, size, offset);
+        fib_stat_record(fib_read_engine(s), start, max_t(ssize_t, n, 0));
+        return n;
+    }
+
     if (size == 0) {
-        return (ssize_t) fib_sequence(*offset);
+        if (*offset > MAX_SEQUENCE_LENGTH)
+            return -EOVERFLOW;
+        trace_fib_request(*offset, FIB_STAT_READ_SEQ, 0, 0);
+        long long f = fib_sequence(*offset);
+        trace_fib_compute(*offset, FIB_STAT_READ_SEQ, 1, 0);
+        fib_stat_record(FIB_STAT_READ_SEQ, start, 0);
+        return (ssize_t) f;
     } else if (size == 1) {
+        if (*offset > MAX_ITER_LENGTH)
+            return -EOVERFLOW;
+        trace_fib_request(*offset, FIB_STAT_READ_MYBN, 0, 0);
         bignum *fib = my_bn_init(1);
-        my_bn_fib_sequence(*offset, fib);
-        char *p = my_bn_to_str(fib);
-        size_t len = strlen(p) + 1;
-        size_t left = copy_to_user(buf, p, len);
+        if (!fib || my_bn_fib_sequence(*offset, fib)) {
+            my_bn_free(fib);
+            return -ENOMEM;
+        }
+        trace_fib_compute(*offset, FIB_STAT_READ_MYBN, 0, 0);
+
+        if (mutex_lock_interruptible(&s->lock)) {
+            my_bn_free(fib);
+            return -EINTR;
+        }
+        /* The digits overwrite the cached decimal result. */
+        s->len = 0;
+        s->pos = 0;
+        const size_t len = my_bn_digits(fib) + 1;
+        char *p = fib_session_buf(s, len);
+        ssize_t left = -ENOMEM;
+        if (p) {
+            my_bn_print(fib, p);
+            trace_fib_format(*offset, FIB_STAT_READ_MYBN, 0, len);
+            left = copy_to_user(buf, p, len);
+            trace_fib_copy(*offset, FIB_STAT_READ_MYBN, 0, len);
+        }
+        mutex_unlock(&s->lock);
+        if (left >= 0)
+            fib_stat_record(FIB_STAT_READ_MYBN, start, len - left);
         my_bn_free(fib);
-        kfree(p);
         return left;
     } else if (size == 2) {
-        bn_t fib;
-        bn_init(fib);
-        // ref_fd_fibonacci(*offset, fib);
-
-        ref_fibonacci(*offset, fib);
-        char *p = kmalloc(100, GFP_KERNEL);
-        bn_snprint(fib, 10, p, 99);
+        trace_fib_request(*offset, FIB_STAT_READ_BN, 0, 0);
+        if (mutex_lock_interruptible(&s->lock))
+            return -EINTR;
 
-        size_t left = copy_to_user(buf, p, strlen(p) + 1);
-
-        bn_free(fib);
-        kfree(p);
+        /* The caller learns the buffer size from FIB_IOC_RESULT_SIZE. */
+        if (fib_session_compute(s, *offset, FIB_STAT_READ_BN)) {
+            mutex_unlock(&s->lock);
+            return -EINTR;
+        }
+        ssize_t left;
+        size_t len;
+        if (s->len) {
+            len = s->len;
+            left = copy_to_user(buf, s->buf, len);
+        } else {
+            /* Nothing to reuse: convert straight into buf, a chunk at a
+             * time, without keeping the whole string around.
+             */
+            struct fib_user_sink us = {
+                .sk = {.size = FIB_CHUNK_SIZE, .flush = fib_user_flush},
+                .buf = buf,
+            };
+            us.sk.buf = fib_session_buf(s, FIB_CHUNK_SIZE);
+            left = us.sk.buf ? bn_write_dec(s->fib, &us.sk) : -ENOMEM;
+            len = us.sk.total + 1;
+            trace_fib_format(*offset, FIB_STAT_READ_BN, s->fib->size, len);
+            if (left >= 0)
+                left = copy_to_user(us.buf, "", 1);
+        }
+        trace_fib_copy(*offset, FIB_STAT_READ_BN, s->fib->size, len);
 
+        mutex_unlock(&s->lock);
+        if (left >= 0)
+            fib_stat_record(FIB_STAT_READ_BN, start, len - left);
         return left;
     }
     return 0;
 }
 
+/* Largest index write() mode serves. */
+static loff_t fib_write_max(size_t mode)
+{
+    switch (mode) {
+    case 0:
+    case 1:
+    case 2:
+        return MAX_SEQUENCE_LENGTH;
+    case 3:
+    case 4:
+        return MAX_ITER_LENGTH;
+    case 7:
+        return MAX_DEC_LENGTH;
+    }
+    return MAX_LENGTH;
+}
+
 /*
  * @ param size : the fibonacci mode
  *
@@ -215,14 +716,29 @@ static ssize_t fib_write(struct file *file,
                          size_t mode,
                          loff_t *offset)
 {
+    struct fib_session *s = file->private_data;
+    const u64 start = ktime_get_ns();
     long long result = 0;
+    ktime_t timer = 0;
+    int rc = 0;
+
+    if (*offset > fib_write_max(mode))
+        return -EOVERFLOW;
+
     bignum *fib = my_bn_init(1);
-    bn_t ref_fib = BN_INITIALIZER;
+    if (!fib)
+        return -ENOMEM;
+
+    if (mutex_lock_interruptible(&s->lock)) {
+        my_bn_free(fib);
+        return -EINTR;
+    }
 
 
     escape(fib);
     escape(&result);
-    escape(ref_fib);
+    escape(s->fib);
+    trace_fib_request(*offset, FIB_STAT_WRITE + mode, 0, 0);
 
     switch (mode) {
     case 0: /* noraml */
@@ -235,28 +751,108 @@ static ssize_t fib_write(struct file *file,
         TIME_PROXY(fib_clz_fastdoubling, result, *offset, timer)
         break;
     case 3: /* my implementaion of bignum*/
-        BN_TIME_PROXY(my_bn_fib_sequence, fib, *offset, timer)
+        MY_BN_TIME_PROXY(my_bn_fib_sequence, fib, *offset, timer, rc)
         break;
     case 4: /* teacher's implementaion bn + fib*/
-        BN_TIME_PROXY(ref_fibonacci, ref_fib, *offset, timer);
+        BN_TIME_PROXY(ref_fibonacci, s->fib, *offset, timer);
         break;
     case 5: /* teacher's implementaion bn +  fast doubling*/
-        BN_TIME_PROXY(ref_fd_fibonacci, ref_fib, *offset, timer);
+        MY_BN_TIME_PROXY(ref_fd_fibonacci, s->fib, *offset, timer, rc)
+        break;
+    case 6: /* bn + fast doubling, products of each step in parallel */
+        MY_BN_TIME_PROXY(ref_fd_fibonacci_par, s->fib, *offset, timer, rc)
+        break;
+    case 7: /* my implementaion of bignum + fast doubling, in decimal */
+        MY_BN_TIME_PROXY(my_bn_fib_fastdoubling, fib, *offset, timer, rc)
         break;
     default:
+        mutex_unlock(&s->lock);
         my_bn_free(fib);
-        bn_free(ref_fib);
         return (ssize_t) 0;
         break;
     }
 
+    trace_fib_compute(*offset, FIB_STAT_WRITE + mode,
+                      mode >= 4 && mode <= 6 ? s->fib->size : 0, 0);
+    fib_session_invalidate(s);
+    mutex_unlock(&s->lock);
     my_bn_free(fib);
-    bn_free(ref_fib);
+    if (rc) /* the my_bn engines return -1 when out of memory */
+        return rc == -EINTR ? -EINTR : -ENOMEM;
+    fib_stat_record(FIB_STAT_WRITE + mode, start, 0);
     return (ssize_t) ktime_to_ns(timer);
 }
 
+/* Time write() mode on F(n) for the benchmark in debugfs. The long long
+ * engines run with preemption disabled; the others allocate, and mode 6
+ * waits for its workers, so they can't.
+ */
+static s64 fib_bench_write_mode(unsigned int mode, u64 n)
+{
+    long long result = 0;
+    u64 t;
+
+    if (n > fib_write_max(mode))
+        return -EOVERFLOW;
+
+    if (mode < 3) {
+        preempt_disable();
+        t = ktime_get_ns();
+        switch (mode) {
+        case 0:
+            result = fib_sequence(n);
+            break;
+        case 1:
+            result = fib_fastdoubling(n);
+            break;
+        case 2:
+            result = fib_clz_fastdoubling(n);
+            break;
+        }
+        t = ktime_get_ns() - t;
+        preempt_enable();
+        escape(&result);
+        return t;
+    }
+
+    if (mode == 3 || mode == 7) {
+        bignum *fib = my_bn_init(1);
+        int rc;
+        if (!fib)
+            return -ENOMEM;
+        t = ktime_get_ns();
+        if (mode == 3)
+            rc = my_bn_fib_sequence(n, fib);
+        else
+            rc = my_bn_fib_fastdoubling(n, fib);
+        t = ktime_get_ns() - t;
+        my_bn_free(fib);
+        return rc ? -ENOMEM : t;
+    }
+
+    bn_t fib;
+    int rc = 0;
+    bn_init(fib);
+    t = ktime_get_ns();
+    switch (mode) {
+    case 4:
+        ref_fibonacci(n, fib);
+        break;
+    case 5:
+        rc = ref_fd_fibonacci(n, fib);
+        break;
+    case 6:
+        rc = ref_fd_fibonacci_par(n, fib);
+        break;
+    }
+    t = ktime_get_ns() - t;
+    bn_free(fib);
+    return rc ? rc : t;
+}
+
 static loff_t fib_device_lseek(struct file *file, loff_t offset, int orig)
 {
+    struct fib_session *s = file->private_data;
     loff_t new_pos = 0;
     switch (orig) {
     case 0: /* SEEK_SET: */
@@ -273,11 +869,271 @@ static loff_t fib_device_lseek(struct file *file, loff_t offset, int orig)
     if (new_pos > MAX_LENGTH)
         new_pos = MAX_LENGTH;  // max case
     if (new_pos < 0)
-        new_pos = 0;        // min case
+        new_pos = 0;  // min case
+
+    /* Every seek rewinds the result. Moving to another index drops its
+     * decimal form; the numbers stay for fib_session_compute to step from.
+     */
+    if (mutex_lock_interruptible(&s->lock))
+        return -EINTR;
+    if (new_pos != s->index)
+        s->len = 0;
+    s->pos = 0;
+    s->next = -1;
     file->f_pos = new_pos;  // This is what we'll use now
+    mutex_unlock(&s->lock);
     return new_pos;
 }
 
+/* Seed F(start) and F(start + 1) with one fast doubling run, then walk the
+ * rest of the range with one bn_add per number.
+ */
+static long fib_ioctl_range(struct fib_range __user *argp)
+{
+    const u64 start = ktime_get_ns();
+    struct fib_range range;
+    if (copy_from_user(&range, argp, sizeof(range)))
+        return -EFAULT;
+    if (range.count && (range.start > MAX_LENGTH ||
+                        range.count - 1 > MAX_LENGTH - range.start))
+        return -EOVERFLOW;
+
+    char __user *buf = u64_to_user_ptr(range.buf);
+    size_t left = range.len;
+    uint64_t done = 0;
+    long rc = 0;
+
+    trace_fib_request(range.start, FIB_STAT_RANGE, 0, range.len);
+    bn_t a, b; /* a = F(i), b = F(i + 1) */
+    bn_init(a);
+    bn_init(b);
+    if (range.count) {
+        rc = ref_fd_fibonacci_pair(range.start + 1, a, b);
+        trace_fib_compute(range.start, FIB_STAT_RANGE, a->size, 0);
+    }
+
+    while (!rc && done < range.count) {
+        if (fatal_signal_pending(current)) {
+            rc = -EINTR;
+            break;
+        }
+        cond_resched();
+        if (fib_raw_size(a) > left) {
+            if (!done)
+                rc = -ENOSPC;
+            break;
+        }
+        ssize_t n = fib_copy_raw(buf, left, a, 0);
+        if (n < 0) {
+            rc = n;
+            break;
+        }
+        buf += n;
+        left -= n;
+        if (++done == range.count)
+            break;
+        bn_add(a, b, a); /* a = F(i + 2) */
+        bn_swap(a, b);
+    }
+
+    trace_fib_copy(range.start, FIB_STAT_RANGE, a->size, range.len - left);
+    bn_free(a);
+    bn_free(b);
+    if (rc)
+        return rc;
+
+    range.count = done;
+    range.len -= left;
+    fib_stat_record(FIB_STAT_RANGE, start, range.len);
+    if (copy_to_user(argp, &range, sizeof(range)))
+        return -EFAULT;
+    return 0;
+}
+
+/* Compute F(index) and format it straight into the mmap region. */
+static long fib_ioctl_compute(struct fib_session *s,
+                              struct fib_compute __user *argp)
+{
+    const u64 start = ktime_get_ns();
+    struct fib_compute req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.format != FIB_FMT_DEC && req.format != FIB_FMT_RAW)
+        return -EINVAL;
+    if (req.index > MAX_LENGTH)
+        return -EOVERFLOW;
+
+    mutex_lock(&s->map_lock);
+    void *map = s->map;
+    size_t map_size = s->map_size;
+    mutex_unlock(&s->map_lock);
+    if (!map)
+        return -ENXIO;
+
+    trace_fib_request(req.index, FIB_STAT_COMPUTE, 0, map_size);
+    if (mutex_lock_interruptible(&s->lock))
+        return -EINTR;
+    if (fib_session_compute(s, req.index, FIB_STAT_COMPUTE)) {
+        mutex_unlock(&s->lock);
+        return -EINTR;
+    }
+    ssize_t n = fib_format(s->fib, req.format, map, map_size);
+    trace_fib_format(req.index, FIB_STAT_COMPUTE, s->fib->size,
+                     max_t(ssize_t, n, 0));
+    mutex_unlock(&s->lock);
+    fib_stat_record(FIB_STAT_COMPUTE, start, 0);
+
+    req.len = n < 0 ? -n : n;
+    if (copy_to_user(argp, &req, sizeof(req)))
+        return -EFAULT;
+    return n < 0 ? -ENOSPC : 0;
+}
+
+/* Queue F(index) to be computed in the background and make it the index of
+ * the next read; poll reports the file readable once the result is in.
+ */
+static long fib_ioctl_submit(struct fib_session *s, __u64 __user *argp)
+{
+    __u64 index;
+
+    if (get_user(index, argp))
+        return -EFAULT;
+    if (index > MAX_LENGTH)
+        return -EOVERFLOW;
+
+    /* The job runs without the lock, but a read or compute may hold it. */
+    if (READ_ONCE(s->busy))
+        return -EBUSY;
+    if (mutex_lock_interruptible(&s->lock))
+        return -EINTR;
+    if (s->busy) {
+        mutex_unlock(&s->lock);
+        return -EBUSY;
+    }
+    if (index != s->index)
+        s->len = 0;
+    s->pos = 0;
+    s->next = index;
+    s->job = index;
+    s->busy = true;
+    queue_work(system_unbound_wq, &s->work);
+    mutex_unlock(&s->lock);
+    return 0;
+}
+
+static long fib_ioctl_set_format(struct fib_session *s, unsigned long format)
+{
+    if (format != FIB_FMT_DEC && format != FIB_FMT_RAW)
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&s->lock))
+        return -EINTR;
+    WRITE_ONCE(s->format, format);
+    s->pos = 0;
+    mutex_unlock(&s->lock);
+    return 0;
+}
+
+/* Upper bound of the bit length of F(n) < phi^n, with log2(phi) rounded up in
+ * 32.32 fixed point.
+ */
+static uint64_t fib_bits(uint64_t n)
+{
+    return (uint64_t) (((unsigned __int128) n * 2981746315ULL) >> 32) + 1;
+}
+
+/* Return the buffer size F(n) needs in a FIB_FMT_* format, 0 for none. */
+static uint64_t fib_result_size(uint64_t n, int format)
+{
+    const uint64_t bits = fib_bits(n);
+
+    switch (format) {
+    case FIB_FMT_DEC:
+        return apm_sprint_size_bits(bits, 10);
+    case FIB_FMT_RAW:
+        return sizeof(struct fib_raw_header) +
+               DIV_ROUND_UP(bits, APM_DIGIT_BITS) * APM_DIGIT_SIZE;
+    }
+    return 0;
+}
+
+/* Report the buffer size F(index) needs in a format, without computing it. */
+static long fib_ioctl_result_size(struct fib_compute __user *argp)
+{
+    struct fib_compute req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.index > MAX_LENGTH)
+        return -EOVERFLOW;
+
+    req.len = fib_result_size(req.index, req.format);
+    if (!req.len)
+        return -EINVAL;
+
+    if (copy_to_user(argp, &req, sizeof(req)))
+        return -EFAULT;
+    return 0;
+}
+
+static long fib_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case FIB_IOC_RANGE:
+        return fib_ioctl_range((struct fib_range __user *) arg);
+    case FIB_IOC_COMPUTE:
+        return fib_ioctl_compute(file->private_data,
+                                 (struct fib_compute __user *) arg);
+    case FIB_IOC_RESULT_SIZE:
+        return fib_ioctl_result_size((struct fib_compute __user *) arg);
+    case FIB_IOC_SET_FORMAT:
+        return fib_ioctl_set_format(file->private_data, arg);
+    case FIB_IOC_SUBMIT:
+        return fib_ioctl_submit(file->private_data, (__u64 __user *) arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/* The first mapping of a file creates its result region with the size of
+ * that mapping; later mappings share it and may not be larger. No mapping may
+ * be larger than the decimal F(MAX_LENGTH), the largest result there is.
+ */
+static int fib_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct fib_session *s = file->private_data;
+    unsigned long size = vma->vm_end - vma->vm_start;
+    int rc = 0;
+
+    if (vma->vm_pgoff)
+        return -EINVAL;
+    if (size > PAGE_ALIGN(fib_result_size(MAX_LENGTH, FIB_FMT_DEC)))
+        return -EINVAL;
+
+    mutex_lock(&s->map_lock);
+    if (!s->map) {
+        s->map = vmalloc_user(size);
+        if (s->map)
+            s->map_size = size;
+        else
+            rc = -ENOMEM;
+    } else if (size > s->map_size) {
+        rc = -EINVAL;
+    }
+    if (!rc)
+        rc = remap_vmalloc_range(vma, s->map, 0);
+    mutex_unlock(&s->map_lock);
+    return rc;
+}
+
+/* Readable unless a submitted computation is still running. */
+static __poll_t fib_poll(struct file *file, poll_table *wait)
+{
+    struct fib_session *s = file->private_data;
+
+    poll_wait(file, &s->wait, wait);
+    return READ_ONCE(s->busy) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
 const struct file_operations fib_fops = {
     .owner = THIS_MODULE,
     .read = fib_read,
@@ -285,14 +1141,34 @@ const struct file_operations fib_fops = {
     .open = fib_open,
     .release = fib_release,
     .llseek = fib_device_lseek,
+    .unlocked_ioctl = fib_ioctl,
+    .mmap = fib_mmap,
+    .poll = fib_poll,
 };
 
 static int __init init_fib_dev(void)
 {
     int rc = 0;
-#ifdef MUTEX
-    mutex_init(&fib_mutex);
-#endif
+
+    rc = xmem_init();
+    if (rc < 0) {
+        printk(KERN_ALERT "Failed to create the buffer pools. rc = %i", rc);
+        return rc;
+    }
+
+    rc = apm_task_init();
+    if (rc < 0) {
+        printk(KERN_ALERT "Failed to create the apm workers. rc = %i", rc);
+        goto failed_task;
+    }
+
+    rc = fib_cache_init();
+    if (rc < 0) {
+        printk(KERN_ALERT "Failed to register the result cache. rc = %i",
+               rc);
+        goto failed_cache;
+    }
+
     // Let's register the device
     // This will dynamically allocate the major number
     rc = alloc_chrdev_region(&fib_dev, 0, 1, DEV_FIBONACCI_NAME);
@@ -301,7 +1177,7 @@ static int __init init_fib_dev(void)
         printk(KERN_ALERT
                "Failed to register the fibonacci char device. rc = %i",
                rc);
-        return rc;
+        goto failed_chrdev;
     }
 
     fib_cdev = cdev_alloc();
@@ -332,6 +1208,9 @@ static int __init init_fib_dev(void)
         rc = -4;
         goto failed_device_create;
     }
+    fib_stats_init();
+    fib_bench_init(fib_stats_debugfs(), FIB_STAT_WRITE_MODES,
+                   fib_bench_write_mode);
     return rc;
 failed_device_create:
     class_destroy(fib_class);
@@ -339,18 +1218,28 @@ failed_class_create:
     cdev_del(fib_cdev);
 failed_cdev:
     unregister_chrdev_region(fib_dev, 1);
+failed_chrdev:
+    fib_cache_exit();
+failed_cache:
+    apm_task_exit();
+failed_task:
+    xmem_exit();
     return rc;
 }
 
 static void __exit exit_fib_dev(void)
 {
-#ifdef MUTEX
-    mutex_destroy(&fib_mutex);
-#endif
+    fib_stats_exit();
+    fib_bench_exit();
     device_destroy(fib_class, fib_dev);
     class_destroy(fib_class);
     cdev_del(fib_cdev);
     unregister_chrdev_region(fib_dev, 1);
+    fib_cache_exit();
+    ref_fd_prefix_free();
+    apm_format_exit();
+    apm_task_exit();
+    xmem_exit();
 }
 
 module_init(init_fib_dev);
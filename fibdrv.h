@@ -0,0 +1,89 @@
+/* Interface shared by the fibdrv kernel module and its user space clients. */
+
+#ifndef _FIBDRV_H_
+#define _FIBDRV_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define FIB_IOC_MAGIC 'f'
+
+/* Header in front of every number returned in binary form. It is followed by
+ * size limbs of digit_size bytes each, least significant limb first, in the
+ * native byte order of the machine running the driver.
+ */
+struct fib_raw_header {
+    __u32 digit_size; /* Bytes per limb. */
+    __u32 size;       /* Number of limbs, zero for F(0). */
+};
+
+/* FIB_IOC_RANGE: compute F(start) .. F(start + count - 1) in one call.
+ *
+ * The numbers are packed back to back into the user buffer buf of len bytes,
+ * each one as a struct fib_raw_header followed by its limbs. On return count
+ * holds how many numbers were stored and len how many bytes were used; the
+ * range stops early if the buffer fills up.
+ */
+struct fib_range {
+    __u64 start; /* Index of the first number. */
+    __u64 count; /* Number of consecutive numbers wanted. */
+    __u64 buf;   /* User pointer to the output buffer. */
+    __u64 len;   /* Size of the output buffer in bytes. */
+};
+
+#define FIB_IOC_RANGE _IOWR(FIB_IOC_MAGIC, 1, struct fib_range)
+
+/* Output formats. */
+enum {
+    FIB_FMT_DEC = 0, /* '\0'-terminated decimal string */
+    FIB_FMT_RAW = 1, /* struct fib_raw_header followed by the limbs */
+};
+
+/* FIB_IOC_COMPUTE: compute F(index) straight into the region mapped by
+ * mmap() on this file descriptor, in one of the FIB_FMT_* formats, so the
+ * result can be read in place without any copy to user space.
+ *
+ * The region is created by the first mmap() of the file, at offset 0, with
+ * the length of that mapping. On return len holds the number of bytes
+ * written; if the region is too small the call fails with ENOSPC and len holds
+ * the size needed.
+ */
+struct fib_compute {
+    __u64 index;  /* Index of the number. */
+    __u32 format; /* One of FIB_FMT_*. */
+    __u32 pad;
+    __u64 len; /* Bytes used or needed. */
+};
+
+#define FIB_IOC_COMPUTE _IOWR(FIB_IOC_MAGIC, 2, struct fib_compute)
+
+/* FIB_IOC_SET_FORMAT: make read() return F(offset) in the FIB_FMT_* format
+ * passed as the argument, with the size argument of read() taken as the
+ * length of the buffer. FIB_FMT_RAW skips radix conversion entirely.
+ *
+ * A result larger than the buffer is delivered over successive reads, each
+ * continuing where the previous one stopped, until read() returns 0. F(offset)
+ * is computed and converted only once; lseek() rewinds to its start.
+ *
+ * Until this is issued read() keeps its original behaviour, where size picks
+ * the engine: 0 returns F(offset) as the return value, 1 and 2 copy a decimal
+ * string from the decimal and binary bignum engines.
+ */
+#define FIB_IOC_SET_FORMAT _IO(FIB_IOC_MAGIC, 3)
+
+/* FIB_IOC_RESULT_SIZE: set len to the size of the buffer that F(index) needs
+ * in format, '\0' included for FIB_FMT_DEC, without computing it. The legacy
+ * decimal read modes need the FIB_FMT_DEC size.
+ */
+#define FIB_IOC_RESULT_SIZE _IOWR(FIB_IOC_MAGIC, 4, struct fib_compute)
+
+/* FIB_IOC_SUBMIT: start computing F(index) in the background, for the __u64
+ * index pointed to by the argument, and return at once. The next read()
+ * moves the file offset to index, unless an lseek() comes first. poll()
+ * reports the file readable once the result is ready; a read before that
+ * blocks, or fails with EAGAIN on a non-blocking file. Fails with EBUSY while
+ * a previous submission is still running.
+ */
+#define FIB_IOC_SUBMIT _IOW(FIB_IOC_MAGIC, 5, __u64)
+
+#endif /* !_FIBDRV_H_ */
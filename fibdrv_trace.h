@@ -0,0 +1,101 @@
+/* Tracepoints marking the phases of a request: cache lookup, computation,
+ * radix conversion and the copy to user space. Each fires as its phase ends,
+ * so the gaps between the timestamps of one request show where it spent its
+ * time. Enable them with
+ *   echo 1 > /sys/kernel/tracing/events/fibdrv/enable
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fibdrv
+
+#if !defined(_FIBDRV_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _FIBDRV_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+#include "fib_stats.h"
+
+TRACE_DEFINE_ENUM(FIB_STAT_WRITE);
+TRACE_DEFINE_ENUM(FIB_STAT_READ_SEQ);
+TRACE_DEFINE_ENUM(FIB_STAT_READ_MYBN);
+TRACE_DEFINE_ENUM(FIB_STAT_READ_BN);
+TRACE_DEFINE_ENUM(FIB_STAT_READ_DEC);
+TRACE_DEFINE_ENUM(FIB_STAT_READ_RAW);
+TRACE_DEFINE_ENUM(FIB_STAT_COMPUTE);
+TRACE_DEFINE_ENUM(FIB_STAT_RANGE);
+
+#define show_fib_engine(e)                                              \
+    __print_symbolic(e, {FIB_STAT_WRITE + 0, "write0"},                 \
+                     {FIB_STAT_WRITE + 1, "write1"},                    \
+                     {FIB_STAT_WRITE + 2, "write2"},                    \
+                     {FIB_STAT_WRITE + 3, "write3"},                    \
+                     {FIB_STAT_WRITE + 4, "write4"},                    \
+                     {FIB_STAT_WRITE + 5, "write5"},                    \
+                     {FIB_STAT_WRITE + 6, "write6"},                    \
+                     {FIB_STAT_WRITE + 7, "write7"},                    \
+                     {FIB_STAT_READ_SEQ, "read_seq"},                   \
+                     {FIB_STAT_READ_MYBN, "read_mybn"},                 \
+                     {FIB_STAT_READ_BN, "read_bn"},                     \
+                     {FIB_STAT_READ_DEC, "read_dec"},                   \
+                     {FIB_STAT_READ_RAW, "read_raw"},                   \
+                     {FIB_STAT_COMPUTE, "compute"}, {FIB_STAT_RANGE, "range"})
+
+/* limbs is the size of the result in apm_digits, 0 where there is none yet;
+ * bytes is what the phase produced or copied. */
+DECLARE_EVENT_CLASS(fib_phase,
+
+    TP_PROTO(u64 index, int engine, unsigned int limbs, size_t bytes),
+
+    TP_ARGS(index, engine, limbs, bytes),
+
+    TP_STRUCT__entry(
+        __field(u64, index)
+        __field(int, engine)
+        __field(unsigned int, limbs)
+        __field(size_t, bytes)
+    ),
+
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->engine = engine;
+        __entry->limbs = limbs;
+        __entry->bytes = bytes;
+    ),
+
+    TP_printk("index=%llu engine=%s limbs=%u bytes=%zu", __entry->index,
+              show_fib_engine(__entry->engine), __entry->limbs,
+              __entry->bytes)
+);
+
+/* A request came in. */
+DEFINE_EVENT(fib_phase, fib_request,
+    TP_PROTO(u64 index, int engine, unsigned int limbs, size_t bytes),
+    TP_ARGS(index, engine, limbs, bytes));
+
+/* The session or shared cache was searched; limbs is 0 on a miss. */
+DEFINE_EVENT(fib_phase, fib_lookup,
+    TP_PROTO(u64 index, int engine, unsigned int limbs, size_t bytes),
+    TP_ARGS(index, engine, limbs, bytes));
+
+/* The number was computed. */
+DEFINE_EVENT(fib_phase, fib_compute,
+    TP_PROTO(u64 index, int engine, unsigned int limbs, size_t bytes),
+    TP_ARGS(index, engine, limbs, bytes));
+
+/* The number was converted to decimal. */
+DEFINE_EVENT(fib_phase, fib_format,
+    TP_PROTO(u64 index, int engine, unsigned int limbs, size_t bytes),
+    TP_ARGS(index, engine, limbs, bytes));
+
+/* The result was copied to user space. */
+DEFINE_EVENT(fib_phase, fib_copy,
+    TP_PROTO(u64 index, int engine, unsigned int limbs, size_t bytes),
+    TP_ARGS(index, engine, limbs, bytes));
+
+#endif /* _FIBDRV_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fibdrv_trace
+#include <trace/define_trace.h>
@@ -1,5 +1,60 @@
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+
 #include "bn.h"
 
+/* Fast doubling of n goes through the pair (F(p - 1), F(p)) for every
+ * prefix p of the bits of n. The pairs of prefixes of up to FD_PREFIX_BITS
+ * bits are cached here as they are first computed, so later calls resume
+ * from the longest cached prefix of their index instead of from (F(0), F(1)).
+ * Entries are published with ready and never change afterwards;
+ * fd_prefix_lock only serializes filling them in.
+ */
+#ifndef FD_PREFIX_BITS
+#define FD_PREFIX_BITS 10
+#endif
+
+static struct {
+    bn_t a0, a1; /* F(p - 1), F(p) */
+    bool ready;
+} fd_prefix[1 << FD_PREFIX_BITS];
+static DEFINE_MUTEX(fd_prefix_lock);
+
+static void fd_prefix_store(unsigned int p, const bn *a0, const bn *a1)
+{
+    mutex_lock(&fd_prefix_lock);
+    if (!fd_prefix[p].ready) {
+        bn_init(fd_prefix[p].a0);
+        bn_init(fd_prefix[p].a1);
+        bn_set(fd_prefix[p].a0, a0);
+        bn_set(fd_prefix[p].a1, a1);
+        smp_store_release(&fd_prefix[p].ready, true);
+    }
+    mutex_unlock(&fd_prefix_lock);
+}
+
+/* Release the prefix cache. */
+void ref_fd_prefix_free(void)
+{
+    for (unsigned int p = 0; p < ARRAY_SIZE(fd_prefix); p++) {
+        if (fd_prefix[p].ready) {
+            bn_free(fd_prefix[p].a0);
+            bn_free(fd_prefix[p].a1);
+            fd_prefix[p].ready = false;
+        }
+    }
+}
+
+/* The three products of a doubling step are independent and of equal size.
+ * Past this many digits they are worth running on separate CPUs. Squarings
+ * go through apm_fork, which keeps those below APM_PARALLEL_THRESHOLD
+ * digits, 1024 by default, on the calling CPU anyway.
+ */
+#ifndef FD_PARALLEL_THRESHOLD
+#define FD_PARALLEL_THRESHOLD 1024
+#endif
+
 /* Compute the Nth Fibonnaci number F_n, where
  * F_0 = 0
  * F_1 = 1
@@ -11,44 +66,134 @@
  * [ 1 1 ]    [   F_n    F_{n+1} ]
  *
  * Exponentiation uses binary power algorithm from high bit to low bit.
+ *
+ * Also returns F_{n-1} in prev. When parallel is set, the two squarings of
+ * each step are forked to the apm workers while the caller does the
+ * multiplication, once operands reach FD_PARALLEL_THRESHOLD digits. Those
+ * workers are bounded and never wait on work queued behind them, so any
+ * number of callers, on workqueues or not, can do this at once.
+ *
+ * Return 0, or -EINTR if the task was killed before it was done, in which
+ * case prev and fib hold garbage.
  */
-void ref_fd_fibonacci(uint64_t n, bn *fib)
+static int fd_fibonacci(uint64_t n, bn *prev, bn *fib, bool parallel)
 {
     if (unlikely(n <= 2)) {
+        bn_set_u32(prev, n != 1); /* F_{-1} = 1, F_0 = 0, F_1 = 1 */
         if (n == 0)
             bn_zero(fib);
         else
             bn_set_u32(fib, 1);
-        return;
+        return 0;
     }
 
-    bn *a1 = fib; /* Use output param fib as a1 */
+    bn *a0 = prev; /* Use output param prev as a0 */
+    bn *a1 = fib;  /* Use output param fib as a1 */
 
-    bn_t a0, tmp, a;
-    bn_init_u32(a0, 0); /*  a0 = 0 */
-    bn_set_u32(a1, 1);  /*  a1 = 1 */
-    bn_init(tmp);       /* tmp = 0 */
+    bn_t tmp, a, sqr, prod;
+    bn_init(tmp); /* tmp = 0 */
     bn_init(a);
+    bn_init(sqr);
+    bn_init(prod);
 
-    /* Start at second-highest bit set. */
-    for (uint64_t k = ((uint64_t) 1) << (62 - __builtin_clzll(n)); k; k >>= 1) {
+    /* The prefixes n >> s are cached for s >= shift: the top FD_PREFIX_BITS
+     * bits of n and shorter. Resume from the longest one cached.
+     */
+    const unsigned int h = 64 - __builtin_clzll(n);
+    const unsigned int shift = h > FD_PREFIX_BITS ? h - FD_PREFIX_BITS : 0;
+    unsigned int s = shift;
+    while (s < h - 1 && !smp_load_acquire(&fd_prefix[n >> s].ready))
+        s++;
+    if (s < h - 1) {
+        bn_set(a0, fd_prefix[n >> s].a0); /* a0 = F(p - 1) */
+        bn_set(a1, fd_prefix[n >> s].a1); /* a1 = F(p) */
+    } else {
+        bn_set_u32(a0, 0); /*  a0 = 0 */
+        bn_set_u32(a1, 1); /*  a1 = 1 */
+    }
+    /* Continue with the bit below the prefix. */
+    int rc = 0;
+    uint64_t k = s ? ((uint64_t) 1) << (s - 1) : 0;
+
+    for (; k; k >>= 1) {
         /* Both ways use two squares, two adds, one multipy and one shift. */
         bn_lshift(a0, 1, a); /* a03 = a0 * 2 */
         bn_add(a, a1, a);    /*   ... + a1 */
-        bn_sqr(a1, tmp);     /* tmp = a1^2 */
-        bn_sqr(a0, a0);      /* a0 = a0 * a0 */
-        bn_add(a0, tmp, a0); /*  ... + a1 * a1 */
-        bn_mul(a1, a, a1);   /*  a1 = a1 * a */
+        if (parallel && a1->size >= FD_PARALLEL_THRESHOLD) {
+            struct bn_sqr_task t0, t1;
+            bn_sqr_fork(&t1, a1, tmp); /* tmp = a1^2 */
+            bn_sqr_fork(&t0, a0, sqr); /* sqr = a0^2 */
+            bn_mul(a1, a, prod);       /* prod = a1 * a */
+            bn_sqr_join(&t1);
+            bn_sqr_join(&t0);
+            bn_add(sqr, tmp, a0); /*  a0 = a0^2 + a1^2 */
+            bn_swap(a1, prod);    /*  a1 = a1 * a */
+        } else {
+            bn_sqr(a1, tmp);     /* tmp = a1^2 */
+            bn_sqr(a0, a0);      /* a0 = a0 * a0 */
+            bn_add(a0, tmp, a0); /*  ... + a1 * a1 */
+            bn_mul(a1, a, a1);   /*  a1 = a1 * a */
+        }
         if (k & n) {
             bn_swap(a1, a0);    /*  a1 <-> a0 */
             bn_add(a0, a1, a1); /*  a1 += a0 */
         }
+        if (k >= ((uint64_t) 1) << shift) { /* Done with prefix n / k. */
+            const unsigned int p = n >> __builtin_ctzll(k);
+            if (!smp_load_acquire(&fd_prefix[p].ready))
+                fd_prefix_store(p, a0, a1);
+        }
+        cond_resched(); /* the last steps of a large n take seconds */
+        if (fatal_signal_pending(current)) {
+            rc = -EINTR;
+            break;
+        }
     }
     /* Now a1 (alias of output parameter fib) = F[n] */
 
-    bn_free(a0);
     bn_free(tmp);
     bn_free(a);
+    bn_free(sqr);
+    bn_free(prod);
+    return rc;
+}
+
+/* F_n, computed on one CPU. Return 0 or -EINTR. */
+int ref_fd_fibonacci(uint64_t n, bn *fib)
+{
+    bn_t prev;
+    bn_init(prev);
+    const int rc = fd_fibonacci(n, prev, fib, false);
+    bn_free(prev);
+    return rc;
+}
+
+/* F_n, with the products of each step spread over three CPUs. Return 0 or
+ * -EINTR.
+ */
+int ref_fd_fibonacci_par(uint64_t n, bn *fib)
+{
+    bn_t prev;
+    bn_init(prev);
+    const int rc = fd_fibonacci(n, prev, fib, true);
+    bn_free(prev);
+    return rc;
+}
+
+/* Smallest index whose last doubling step has FD_PARALLEL_THRESHOLD-digit
+ * operands: F_n has about n / 1.44 bits, and those operands half of them.
+ */
+#define FD_PARALLEL_INDEX \
+    ((uint64_t) FD_PARALLEL_THRESHOLD * APM_DIGIT_BITS * 2 * 1440 / 1000)
+
+/* F_{n-1} and F_n, so that callers can step to a neighbouring index with a
+ * single addition or subtraction. Only indices large enough to gain from it
+ * take the parallel path, so that concurrent sessions asking for small ones
+ * keep to their own CPU. Return 0 or -EINTR.
+ */
+int ref_fd_fibonacci_pair(uint64_t n, bn *prev, bn *fib)
+{
+    return fd_fibonacci(n, prev, fib, n >= FD_PARALLEL_INDEX);
 }
 
 
@@ -66,7 +211,7 @@ void ref_fibonacci(uint64_t n, bn *fib)
     bn_init_u32(b, 1);
 
     bn_init_u32(fib, 1);
-    for (int i = 2; i <= n; i++) {
+    for (uint64_t i = 2; i <= n; i++) {
         bn_swap(b, fib);
         bn_add(a, b, fib);
         bn_swap(a, b);
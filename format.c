@@ -1,49 +1,50 @@
 #include <linux/ctype.h>
 #include <linux/kernel.h>
+#include <linux/mutex.h>
 
 #include "apm.h"
 
 #define UINT64_C(c) c##ULL
-/* radix_sizes[B] = number of radix-B digits needed to represent an 8-bit
- * unsigned integer; B on [2, 36] */
-static const unsigned __int128 radix_sizes[37] = {
+/* radix_sizes[B] = number of radix-B digits needed to represent one bit,
+ * i.e. 1 / log2(B), rounded up in 32.32 fixed point; B on [2, 36] */
+static const uint64_t radix_sizes[37] = {
     /*  0 */ 0,
     /*  1 */ 0,
-    /*  2 */ 800000000,
-    /*  3 */ 504743803,
-    /*  4 */ 400000000,
-    /*  5 */ 344541246,
-    /*  6 */ 309482246,
-    /*  7 */ 284965750,
-    /*  8 */ 266666667,
-    /*  9 */ 252371901,
-    /* 10 */ 240823997,
-    /* 11 */ 231251861,
-    /* 12 */ 223154357,
-    /* 13 */ 216190524,
-    /* 14 */ 210119628,
-    /* 15 */ 204766420,
-    /* 16 */ 200000000,
-    /* 17 */ 195720434,
-    /* 18 */ 191849973,
-    /* 19 */ 188327131,
-    /* 20 */ 185102571,
-    /* 21 */ 182136199,
-    /* 22 */ 179395059,
-    /* 23 */ 176851784,
-    /* 24 */ 174483434,
-    /* 25 */ 172270623,
-    /* 26 */ 170196843,
-    /* 27 */ 168247934,
-    /* 28 */ 166411678,
-    /* 29 */ 164677466,
-    /* 30 */ 163036038,
-    /* 31 */ 161479269,
-    /* 32 */ 160000000,
-    /* 33 */ 158591891,
-    /* 34 */ 157249306,
-    /* 35 */ 155967218,
-    /* 36 */ 154741123};
+    /*  2 */ 4294967296U,
+    /*  3 */ 2709822658U,
+    /*  4 */ 2147483648U,
+    /*  5 */ 1849741733U,
+    /*  6 */ 1661520156U,
+    /*  7 */ 1529898220U,
+    /*  8 */ 1431655766U,
+    /*  9 */ 1354911329U,
+    /* 10 */ 1292913987U,
+    /* 11 */ 1241523976U,
+    /* 12 */ 1198050830U,
+    /* 13 */ 1160664036U,
+    /* 14 */ 1128071164U,
+    /* 15 */ 1099331346U,
+    /* 16 */ 1073741824U,
+    /* 17 */ 1050766078U,
+    /* 18 */ 1029986702U,
+    /* 19 */ 1011073585U,
+    /* 20 */ 993761859U,
+    /* 21 */ 977836273U,
+    /* 22 */ 963119892U,
+    /* 23 */ 949465784U,
+    /* 24 */ 936750802U,
+    /* 25 */ 924870867U,
+    /* 26 */ 913737343U,
+    /* 27 */ 903274220U,
+    /* 28 */ 893415895U,
+    /* 29 */ 884105414U,
+    /* 30 */ 875293063U,
+    /* 31 */ 866935226U,
+    /* 32 */ 858993460U,
+    /* 33 */ 851433730U,
+    /* 34 */ 844225783U,
+    /* 35 */ 837342624U,
+    /* 36 */ 830760078U};
 
 static const struct {
     apm_digit max_radix;
@@ -129,24 +130,37 @@ static const struct {
 };
 
 /* Return the size, in bytes, that a character string must be in order to hold
- * the representation of a LEN-digit number in BASE. Return value does NOT
+ * the representation in BASE of any number below 2^BITS. Return value does NOT
  * account for terminating '\0'.
  */
-static size_t apm_string_size(apm_size size, unsigned int radix)
+static size_t apm_string_size(uint64_t bits, unsigned int radix)
 {
     ASSERT(radix >= 2);
     ASSERT(radix <= 36);
 
     if ((radix & (radix - 1)) == 0) {
-        unsigned int lg = apm_digit_lsb_shift(radix);
-        return ((size * APM_DIGIT_BITS + lg - 1) / lg) + 1;
+        /* apm_get_str emits whole limbs, or whole shifts of lg * od bits. */
+        const unsigned int lg = apm_digit_lsb_shift(radix);
+        const unsigned int od = APM_DIGIT_BITS / lg;
+        const uint64_t limbs = (bits + APM_DIGIT_BITS - 1) / APM_DIGIT_BITS;
+        const unsigned int shift = lg * od;
+        return ((limbs * APM_DIGIT_BITS + shift - 1) / shift) * od + 1;
     }
 
-    /* round up to second next largest integer */
-    unsigned __int128 res = (radix_sizes[radix] * (size * APM_DIGIT_SIZE));
-    res >>= 26;
+    return (size_t) (((unsigned __int128) bits * radix_sizes[radix]) >> 32) + 1;
+}
 
-    return (size_t) res;
+/* Return the number of significant bits in u[size]. */
+static uint64_t apm_bits(const apm_digit *u, apm_size size)
+{
+    APM_NORMALIZE(u, size);
+    if (!size)
+        return 0;
+#if APM_DIGIT_SIZE == 4
+    return (uint64_t) size * APM_DIGIT_BITS - __builtin_clz(u[size - 1]);
+#else
+    return (uint64_t) size * APM_DIGIT_BITS - __builtin_clzll(u[size - 1]);
+#endif
 }
 
 /* Set u[size] = u[usize] / v, and return the remainder. */
@@ -184,6 +198,365 @@ static apm_digit apm_ddivi(apm_digit *u, apm_size size, apm_digit v)
 
 static const char radix_chars[37] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
+void apm_sink_put(struct apm_sink *sk, const char *p, size_t n)
+{
+    sk->total += n;
+    while (n && !sk->err) {
+        if (sk->len == sk->size) {
+            if (!sk->flush) /* Truncate. */
+                return;
+            sk->err = sk->flush(sk);
+            sk->len = 0;
+            continue;
+        }
+        const size_t k = min(n, sk->size - sk->len);
+        memcpy(sk->buf + sk->len, p, k);
+        sk->len += k;
+        p += k;
+        n -= k;
+    }
+}
+
+/* Write n zeros to sk. */
+static void apm_sink_zeros(struct apm_sink *sk, size_t n)
+{
+    static const char zeros[32] = "00000000000000000000000000000000";
+
+    while (n) {
+        const size_t k = min(n, sizeof(zeros));
+        apm_sink_put(sk, zeros, k);
+        n -= k;
+    }
+}
+
+/* Write the decimal digits of r to g, most significant first, padded with
+ * leading zeros to width digits, and return their number. */
+static unsigned int apm_digit_dec(apm_digit r, unsigned int width, char *g)
+{
+    char t[24];
+    unsigned int n = 0;
+
+    do {
+        t[n++] = radix_chars[r % 10];
+        r /= 10;
+    } while (r);
+    while (n < width)
+        t[n++] = '0';
+    for (unsigned int i = 0; i < n; i++)
+        g[i] = t[n - 1 - i];
+    return n;
+}
+
+/* Write the decimal digits of u[size] to sk, padded with leading zeros to
+ * width digits. With a width of 0 no leading zeros are written.
+ *
+ * The remainders of repeated division by max_radix come out least
+ * significant first, so they are kept and written out from the last one.
+ */
+static void apm_dec_basecase(const apm_digit *u,
+                             apm_size size,
+                             size_t width,
+                             struct apm_sink *sk)
+{
+    const apm_digit max_radix = radix_table[10].max_radix;
+    const unsigned int max_power = radix_table[10].max_power;
+    char g[24];
+
+    APM_NORMALIZE(u, size);
+    if (!size) {
+        apm_sink_zeros(sk, width);
+        return;
+    }
+
+    /* Every max_radix takes up a little less than one apm_digit. */
+    apm_digit *tmp = APM_TMP_ALLOC(2 * size + size / 32 + 2);
+    apm_digit *rem = tmp + size;
+    apm_size n = 0;
+
+    apm_copy(u, size, tmp);
+    do {
+        rem[n++] = apm_ddivi(tmp, size, max_radix);
+        size -= (tmp[size - 1] == 0);
+    } while (size);
+
+    const unsigned int k = apm_digit_dec(rem[n - 1], 0, g);
+    const size_t digits = (size_t) (n - 1) * max_power + k;
+    if (width > digits)
+        apm_sink_zeros(sk, width - digits);
+    apm_sink_put(sk, g, k);
+    while (--n)
+        apm_sink_put(sk, g, apm_digit_dec(rem[n - 1], max_power, g));
+
+    APM_TMP_FREE(tmp);
+}
+
+#define APM_DIGIT_NEG(u, size) ((u)[(size) -1] >> (APM_DIGIT_BITS - 1))
+
+/* Set t[2 * size + 2] = B^(2 * size) - d[size] * w[size + 2] in two's
+ * complement, where B = 2^APM_DIGIT_BITS. */
+static void apm_recip_rem(const apm_digit *d,
+                          apm_size size,
+                          const apm_digit *w,
+                          apm_digit *t)
+{
+    const apm_size tsize = 2 * size + 2;
+
+    apm_mul(d, size, w, size + 2, t);
+    for (apm_size i = 0; i < tsize; i++)
+        t[i] = ~t[i];
+    apm_daddi(t, tsize, 1);
+    apm_daddi(t + 2 * size, 2, 1);
+}
+
+/* Set w[size + 2] = floor(B^(2 * size) / d[size]), for d[size - 1] != 0.
+ *
+ * Newton's iteration for 1 / d [cf. Knuth 4.3.3, vol.2, 3rd ed, algorithm R]
+ * turns the reciprocal x of the top digits of d into
+ * x + x * (B^(2 * size) - d * x) / B^(2 * size), good to about twice as many
+ * digits. The last few units are then fixed by comparing d * x with
+ * B^(2 * size) directly.
+ */
+static void apm_recip(const apm_digit *d, apm_size size, apm_digit *w)
+{
+    static const apm_digit one = 1;
+    const apm_size wsize = size + 2, tsize = 2 * size + 2;
+    apm_digit *t = APM_TMP_ALLOC(tsize);
+
+    ASSERT(d[size - 1] != 0);
+
+    if (size <= 4) {
+        /* Long division of B^(2 * size), one bit at a time. */
+        apm_zero(w, wsize);
+        apm_zero(t, size + 1);
+        for (uint64_t i = 0; i <= (uint64_t) 2 * size * APM_DIGIT_BITS; i++) {
+            apm_lshifti(t, size + 1, 1);
+            apm_lshifti(w, wsize, 1);
+            t[0] |= (i == 0);
+            if (apm_cmp(t, size + 1, d, size) >= 0) {
+                apm_subi(t, size + 1, d, size);
+                w[0] |= 1;
+            }
+        }
+        APM_TMP_FREE(t);
+        return;
+    }
+
+    /* Take enough digits that the error left after one step is a few units. */
+    const apm_size h = (size + 4) / 2;
+    apm_zero(w, size - h);
+    apm_recip(d + size - h, h, w + size - h);
+
+    apm_recip_rem(d, size, w, t);
+    const bool neg = APM_DIGIT_NEG(t, tsize);
+    if (neg) {
+        for (apm_size i = 0; i < tsize; i++)
+            t[i] = ~t[i];
+        apm_daddi(t, tsize, 1);
+    }
+    const apm_size esize = apm_rsize(t, tsize);
+    if (esize) {
+        apm_digit *c = APM_TMP_ALLOC(wsize + esize);
+        apm_mul(w, wsize, t, esize, c);
+        if (wsize + esize > 2 * size) {
+            const apm_size csize =
+                apm_rsize(c + 2 * size, wsize + esize - 2 * size);
+            ASSERT(csize <= wsize);
+            if (neg)
+                apm_subi(w, wsize, c + 2 * size, csize);
+            else
+                apm_addi(w, wsize, c + 2 * size, csize);
+        }
+        APM_TMP_FREE(c);
+    }
+
+    apm_recip_rem(d, size, w, t);
+    while (APM_DIGIT_NEG(t, tsize)) {
+        apm_addi(t, tsize, d, size);
+        apm_subi(w, wsize, &one, 1);
+    }
+    while (apm_cmp(t, tsize, d, size) >= 0) {
+        apm_subi(t, tsize, d, size);
+        apm_daddi(w, wsize, 1);
+    }
+    APM_TMP_FREE(t);
+}
+
+/* Set q[usize - size + 1] = u[usize] / d[size] and r[size] = u mod d, for
+ * size <= usize <= 2 * size and inv = apm_recip(d) [cf. Menezes et al.,
+ * Handbook of Applied Cryptography, 14.42]. The quotient of the top digits of
+ * u and inv is off by at most two, made up by subtracting d again.
+ */
+static void apm_divrem_inv(const apm_digit *u,
+                           apm_size usize,
+                           const apm_digit *d,
+                           apm_size size,
+                           const apm_digit *inv,
+                           apm_digit *q,
+                           apm_digit *r)
+{
+    ASSERT(usize >= size);
+    ASSERT(usize <= 2 * size);
+
+    const apm_size qsize = usize - size + 1;
+    apm_digit *t = APM_TMP_ALLOC(qsize + size + 2);
+
+    apm_mul(u + size - 1, qsize, inv, size + 2, t);
+    apm_copy(t + size + 1, qsize, q);
+    apm_mul(q, qsize, d, size, t);
+    apm_sub_n(u, t, usize, t);
+    while (apm_cmp(t, usize, d, size) >= 0) {
+        apm_subi(t, usize, d, size);
+        apm_daddi(q, qsize, 1);
+    }
+    apm_copy(t, size, r);
+    APM_TMP_FREE(t);
+}
+
+/* Powers p[j] = 10^(D * 2^j) by which decimal conversion splits its numbers,
+ * for D decimal digits per apm_digit, with their reciprocals. Each is built
+ * on first use and kept until apm_format_exit, so only the first conversion
+ * of a number that large pays for it. Entries below dec_npow never change.
+ */
+static struct {
+    apm_digit *p, *inv;
+    apm_size size;
+} dec_pow[32];
+static unsigned int dec_npow;
+static DEFINE_MUTEX(dec_pow_lock);
+
+static bool dec_pow_add(unsigned int j)
+{
+    apm_digit *p, *inv;
+    apm_size size;
+
+    if (j == 0) {
+        size = 1;
+        p = apm_new(size);
+        if (!p)
+            return false;
+        p[0] = radix_table[10].max_radix;
+    } else {
+        p = apm_new(2 * dec_pow[j - 1].size);
+        if (!p)
+            return false;
+        apm_sqr(dec_pow[j - 1].p, dec_pow[j - 1].size, p);
+        size = apm_rsize(p, 2 * dec_pow[j - 1].size);
+    }
+    inv = apm_new(size + 2);
+    if (!inv) {
+        apm_free(p);
+        return false;
+    }
+    apm_recip(p, size, inv);
+
+    dec_pow[j].p = p;
+    dec_pow[j].inv = inv;
+    dec_pow[j].size = size;
+    smp_store_release(&dec_npow, j + 1);
+    return true;
+}
+
+/* Return the first j for which p[j]^2 may have size digits, building the
+ * powers up to it as needed, or -1 if there is no memory for them. */
+static int dec_pow_level(apm_size size)
+{
+    for (unsigned int j = 0; j < ARRAY_SIZE(dec_pow); j++) {
+        if (j >= smp_load_acquire(&dec_npow)) {
+            mutex_lock(&dec_pow_lock);
+            const bool ok = j < dec_npow || dec_pow_add(j);
+            mutex_unlock(&dec_pow_lock);
+            if (!ok)
+                return -1;
+        }
+        if (2 * (uint64_t) dec_pow[j].size >= size)
+            return j;
+    }
+    return -1;
+}
+
+void apm_format_exit(void)
+{
+    for (unsigned int j = 0; j < dec_npow; j++) {
+        apm_free(dec_pow[j].p);
+        apm_free(dec_pow[j].inv);
+    }
+    dec_npow = 0;
+}
+
+/* Write u[size] < p[j] to sk as exactly D * 2^j decimal digits, split into
+ * halves by p[j - 1]. */
+static void apm_dec_fixed(const apm_digit *u,
+                          apm_size size,
+                          unsigned int j,
+                          struct apm_sink *sk)
+{
+    const size_t width = (size_t) radix_table[10].max_power << j;
+
+    if (sk->err)
+        return;
+    APM_NORMALIZE(u, size);
+    if (j == 0 || size < DC_GET_STR_THRESHOLD) {
+        apm_dec_basecase(u, size, width, sk);
+        return;
+    }
+
+    const apm_size m = dec_pow[j - 1].size;
+    if (size < m) {
+        apm_sink_zeros(sk, width / 2);
+        apm_dec_fixed(u, size, j - 1, sk);
+        return;
+    }
+
+    apm_digit *q = APM_TMP_ALLOC(size - m + 1 + m);
+    apm_digit *r = q + size - m + 1;
+    apm_divrem_inv(u, size, dec_pow[j - 1].p, m, dec_pow[j - 1].inv, q, r);
+    apm_dec_fixed(q, size - m + 1, j - 1, sk);
+    apm_dec_fixed(r, m, j - 1, sk);
+    APM_TMP_FREE(q);
+}
+
+/* Write the decimal digits of u[size] to sk without leading zeros. Past
+ * DC_GET_STR_THRESHOLD digits, u is split by the power of ten closest to its
+ * square root and both halves are converted recursively [cf. Knuth 4.4,
+ * vol.2, 3rd ed, exercise 14], so that conversion costs O(M(n) log n) instead
+ * of O(n^2). Digits come out most significant first.
+ */
+static void apm_dec_str(const apm_digit *u, apm_size size, struct apm_sink *sk)
+{
+    if (sk->err)
+        return;
+    APM_NORMALIZE(u, size);
+    const int j = size < DC_GET_STR_THRESHOLD ? -1 : dec_pow_level(size);
+    if (j < 0) {
+        apm_dec_basecase(u, size, 0, sk);
+        return;
+    }
+
+    /* p[j - 1]^2 has fewer digits than u, so u > p[j] and the quotient is
+     * not zero. */
+    const apm_size m = dec_pow[j].size;
+    apm_digit *q = APM_TMP_ALLOC(size - m + 1 + m);
+    apm_digit *r = q + size - m + 1;
+    apm_divrem_inv(u, size, dec_pow[j].p, m, dec_pow[j].inv, q, r);
+    apm_dec_str(q, size - m + 1, sk);
+    apm_dec_fixed(r, m, j, sk);
+    APM_TMP_FREE(q);
+}
+
+ssize_t apm_write_dec(const apm_digit *u, apm_size size, struct apm_sink *sk)
+{
+    APM_NORMALIZE(u, size);
+    if (size)
+        apm_dec_str(u, size, sk);
+    else
+        apm_sink_put(sk, "0", 1);
+    if (sk->flush && sk->len && !sk->err) {
+        sk->err = sk->flush(sk);
+        sk->len = 0;
+    }
+    return sk->err ? sk->err : (ssize_t) sk->total;
+}
+
 /* Return u[size] as a null-terminated character string in a radix on [2,36]. */
 static char *apm_get_str(const apm_digit *u,
                          apm_size size,
@@ -207,7 +580,7 @@ static char *apm_get_str(const apm_digit *u,
     const unsigned int max_power = radix_table[radix].max_power;
 
     if (!out)
-        out = MALLOC(apm_string_size(size, radix) + 1);
+        out = MALLOC(apm_string_size(apm_bits(u, size), radix) + 1);
     char *outp = out;
 
     if ((radix & (radix - 1)) == 0) { /* Radix is a power of two. */
@@ -288,6 +661,33 @@ static char *apm_get_str(const apm_digit *u,
     return out;
 }
 
+size_t apm_sprint_size(const apm_digit *u, apm_size size, unsigned int radix)
+{
+    return apm_sprint_size_bits(apm_bits(u, size), radix);
+}
+
+size_t apm_sprint_size_bits(uint64_t bits, unsigned int radix)
+{
+    return (bits ? apm_string_size(bits, radix) : 1) + 1;
+}
+
+size_t apm_sprint(const apm_digit *u,
+                  apm_size size,
+                  unsigned int radix,
+                  char *dst)
+{
+    ASSERT(u != NULL);
+    ASSERT(dst != NULL);
+
+    if (radix == 10) {
+        struct apm_sink sk = {.buf = dst, .size = SIZE_MAX};
+        apm_write_dec(u, size, &sk);
+        dst[sk.len] = '\0';
+        return sk.len;
+    }
+    return strlen(apm_get_str(u, size, radix, dst));
+}
+
 void apm_snprint(const apm_digit *u,
                  apm_size size,
                  unsigned int radix,
@@ -299,8 +699,24 @@ void apm_snprint(const apm_digit *u,
     ASSERT(radix >= 2);
     ASSERT(radix <= 36);
 
+    if (max_len == 0)
+        return;
+
+    /* Decimal digits come out most significant first, and whatever does not
+     * fit is simply dropped. */
+    if (radix == 10) {
+        struct apm_sink sk = {.buf = dst, .size = max_len - 1};
+        apm_write_dec(u, size, &sk);
+        dst[sk.len] = '\0';
+        return;
+    }
+
     APM_NORMALIZE(u, size);
-    const size_t string_size = apm_string_size(size, radix) + 1;
+    const size_t string_size = apm_sprint_size(u, size, radix);
+    if (string_size <= max_len) {
+        apm_get_str(u, size, radix, dst);
+        return;
+    }
 
     char *str = MALLOC(string_size);
     if (!str) {
@@ -0,0 +1,216 @@
+#include <linux/kernel.h>
+#include <linux/local_lock.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+#include "memory.h"
+
+/* Every buffer starts with a header recording its class, or XMEM_LARGE, and
+ * the size asked for, so that xfree and xrealloc need nothing else.
+ */
+#define XMEM_LARGE XMEM_CLASSES
+
+struct xmem_hdr {
+    size_t size;
+    unsigned int cls;
+} __aligned(16);
+
+/* The lists of a CPU are also reached from softirq context, where cache
+ * entries are freed after their RCU grace period, so they are only touched
+ * under lock with interrupts off.
+ */
+struct xmem_cpu {
+    local_lock_t lock;
+    void *free[XMEM_CLASSES][XMEM_CPU_CACHE];
+    unsigned int nfree[XMEM_CLASSES];
+    struct xmem_stats st;
+};
+
+static struct kmem_cache *xmem_caches[XMEM_CLASSES];
+static DEFINE_PER_CPU(struct xmem_cpu, xmem_cpu) = {
+    .lock = INIT_LOCAL_LOCK(lock),
+};
+static char xmem_names[XMEM_CLASSES][16];
+
+static unsigned int xmem_class(size_t size)
+{
+    size += sizeof(struct xmem_hdr);
+    if (size > (size_t) 1 << XMEM_MAX_SHIFT)
+        return XMEM_LARGE;
+    if (size <= (size_t) 1 << XMEM_MIN_SHIFT)
+        return 0;
+    return order_base_2(size) - XMEM_MIN_SHIFT;
+}
+
+static inline size_t xmem_class_size(unsigned int cls)
+{
+    return ((size_t) 1 << (cls + XMEM_MIN_SHIFT)) - sizeof(struct xmem_hdr);
+}
+
+void *xmalloc(size_t size)
+{
+    unsigned int cls = xmem_class(size);
+    struct xmem_hdr *h = NULL;
+    struct xmem_cpu *c;
+    unsigned long flags;
+
+    if (cls != XMEM_LARGE && !xmem_caches[cls])
+        cls = XMEM_LARGE;
+
+    local_lock_irqsave(&xmem_cpu.lock, flags);
+    c = this_cpu_ptr(&xmem_cpu);
+    c->st.allocs++;
+    if (cls != XMEM_LARGE && c->nfree[cls]) {
+        h = c->free[cls][--c->nfree[cls]];
+        c->st.cache_hits++;
+    } else if (cls != XMEM_LARGE) {
+        c->st.slab_allocs++;
+    } else {
+        c->st.large++;
+    }
+    local_unlock_irqrestore(&xmem_cpu.lock, flags);
+
+    if (!h) {
+        if (cls != XMEM_LARGE)
+            h = kmem_cache_alloc(xmem_caches[cls], GFP_KERNEL);
+        else
+            h = kvmalloc(sizeof(*h) + size, GFP_KERNEL);
+        if (!h) {
+            printk("Out of memory.\n");
+            return NULL;
+        }
+        h->cls = cls;
+    }
+    h->size = size;
+    return h + 1;
+}
+
+void *xzalloc(size_t size)
+{
+    void *p = xmalloc(size);
+    if (p)
+        memset(p, 0, size);
+    return p;
+}
+
+void xfree(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    struct xmem_hdr *h = (struct xmem_hdr *) ptr - 1;
+    const unsigned int cls = h->cls;
+    struct xmem_cpu *c;
+    unsigned long flags;
+
+    local_lock_irqsave(&xmem_cpu.lock, flags);
+    c = this_cpu_ptr(&xmem_cpu);
+    c->st.frees++;
+    if (cls != XMEM_LARGE && c->nfree[cls] < XMEM_CPU_CACHE) {
+        c->free[cls][c->nfree[cls]++] = h;
+        h = NULL;
+    } else if (cls != XMEM_LARGE) {
+        c->st.slab_frees++;
+    }
+    local_unlock_irqrestore(&xmem_cpu.lock, flags);
+
+    if (!h)
+        return;
+    if (cls != XMEM_LARGE)
+        kmem_cache_free(xmem_caches[cls], h);
+    else
+        kvfree(h);
+}
+
+void *xrealloc(void *ptr, size_t size)
+{
+    if (!ptr)
+        return xmalloc(size);
+    if (size == 0) {
+        xfree(ptr);
+        return NULL;
+    }
+
+    struct xmem_hdr *h = (struct xmem_hdr *) ptr - 1;
+    const bool in_place =
+        h->cls != XMEM_LARGE && size <= xmem_class_size(h->cls);
+
+    unsigned long flags;
+    local_lock_irqsave(&xmem_cpu.lock, flags);
+    struct xmem_cpu *c = this_cpu_ptr(&xmem_cpu);
+    c->st.reallocs++;
+    c->st.realloc_ip += in_place;
+    local_unlock_irqrestore(&xmem_cpu.lock, flags);
+
+    if (in_place) {
+        h->size = size;
+        return ptr;
+    }
+
+    void *p = xmalloc(size);
+    if (!p)
+        return NULL;
+    memcpy(p, ptr, min(size, h->size));
+    xfree(ptr);
+    return p;
+}
+
+void xmem_get_stats(struct xmem_stats *st)
+{
+    int cpu;
+
+    memset(st, 0, sizeof(*st));
+    for_each_possible_cpu (cpu) {
+        const struct xmem_stats *s = &per_cpu_ptr(&xmem_cpu, cpu)->st;
+        st->allocs += s->allocs;
+        st->frees += s->frees;
+        st->reallocs += s->reallocs;
+        st->realloc_ip += s->realloc_ip;
+        st->cache_hits += s->cache_hits;
+        st->slab_allocs += s->slab_allocs;
+        st->slab_frees += s->slab_frees;
+        st->large += s->large;
+    }
+}
+
+void xmem_reset_stats(void)
+{
+    int cpu;
+
+    for_each_possible_cpu (cpu)
+        memset(&per_cpu_ptr(&xmem_cpu, cpu)->st, 0, sizeof(struct xmem_stats));
+}
+
+int xmem_init(void)
+{
+    for (unsigned int i = 0; i < XMEM_CLASSES; i++) {
+        const size_t size = (size_t) 1 << (i + XMEM_MIN_SHIFT);
+        snprintf(xmem_names[i], sizeof(xmem_names[i]), "fib-%zu", size);
+        xmem_caches[i] = kmem_cache_create(
+            xmem_names[i], size, __alignof__(struct xmem_hdr), 0, NULL);
+        if (!xmem_caches[i]) {
+            xmem_exit();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+void xmem_exit(void)
+{
+    int cpu;
+
+    for_each_possible_cpu (cpu) {
+        struct xmem_cpu *c = per_cpu_ptr(&xmem_cpu, cpu);
+        for (unsigned int i = 0; i < XMEM_CLASSES; i++) {
+            while (c->nfree[i])
+                kmem_cache_free(xmem_caches[i], c->free[i][--c->nfree[i]]);
+        }
+    }
+    for (unsigned int i = 0; i < XMEM_CLASSES; i++) {
+        kmem_cache_destroy(xmem_caches[i]);
+        xmem_caches[i] = NULL;
+    }
+}
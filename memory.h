@@ -4,34 +4,56 @@
 #include <linux/printk.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/types.h>
 
-/* TODO: implement custom memory allocator which fits arbitrary precision
- * operations
+/* Pooled allocator for the buffers of arbitrary precision operations.
+ *
+ * Requests are rounded up to a power of two between XMEM_MIN_SHIFT and
+ * XMEM_MAX_SHIFT bytes and served from a kmem_cache per size class. Each CPU
+ * keeps the last few buffers freed in every class and hands them out again
+ * before going to the slab allocator, which is what the temporaries of the
+ * bignum loops keep asking for. Larger requests go to kvmalloc.
+ *
+ * Memory from xmalloc and xrealloc is not zeroed; callers that need it use
+ * xzalloc.
  */
-static inline void *xmalloc(size_t size)
-{
-    void *p;
-    if (!(p = kzalloc(size, GFP_KERNEL))) {
-        printk("Out of memory.\n");
-        return NULL;
-    }
-    return p;
-}
-
-static inline void *xrealloc(void *ptr, size_t size)
-{
-    void *p;
-    if (!(p = krealloc(ptr, size, GFP_KERNEL)) && size != 0) {
-        printk("Out of memory.\n");
-        return NULL;
-    }
-    return p;
-}
-
-static inline void xfree(void *ptr)
-{
-    kfree(ptr);
-}
+#ifndef XMEM_MIN_SHIFT
+#define XMEM_MIN_SHIFT 5
+#endif
+#ifndef XMEM_MAX_SHIFT
+#define XMEM_MAX_SHIFT 17
+#endif
+#define XMEM_CLASSES (XMEM_MAX_SHIFT - XMEM_MIN_SHIFT + 1)
+
+/* Buffers each CPU keeps per size class. */
+#ifndef XMEM_CPU_CACHE
+#define XMEM_CPU_CACHE 4
+#endif
+
+struct xmem_stats {
+    u64 allocs;      /* Calls to xmalloc, xzalloc and moving xreallocs. */
+    u64 frees;       /* Buffers given back. */
+    u64 reallocs;    /* Calls to xrealloc on an existing buffer. */
+    u64 realloc_ip;  /* Of those, the ones that stayed in place. */
+    u64 cache_hits;  /* Allocations served from a per-CPU free list. */
+    u64 slab_allocs; /* Allocations that reached a kmem_cache. */
+    u64 slab_frees;  /* Buffers that went back to a kmem_cache. */
+    u64 large;       /* Allocations above the largest class. */
+};
+
+void *xmalloc(size_t size);
+void *xzalloc(size_t size);
+void *xrealloc(void *ptr, size_t size);
+void xfree(void *ptr);
+
+/* Sum the counters of all CPUs into st. */
+void xmem_get_stats(struct xmem_stats *st);
+
+/* Zero the counters. */
+void xmem_reset_stats(void);
+
+int xmem_init(void);
+void xmem_exit(void);
 
 #define MALLOC(n) xmalloc(n)
 #define REALLOC(p, n) xrealloc(p, n)
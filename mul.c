@@ -1,3 +1,4 @@
+#include <linux/kernel.h>
 #include <linux/types.h>
 
 #include "apm.h"
@@ -16,12 +17,14 @@ void _apm_mul_base(const apm_digit *u,
     /* Find real sizes and zero any part of answer which will not be set. */
     apm_size ul = apm_rsize(u, usize);
     apm_size vl = apm_rsize(v, vsize);
+    /* One or both are zero. */
+    if (!ul || !vl) {
+        apm_zero(w, usize + vsize);
+        return;
+    }
     /* Zero digits which will not be set in multiply-and-add loop. */
     if (ul + vl != usize + vsize)
         apm_zero(w + (ul + vl), usize + vsize - (ul + vl));
-    /* One or both are zero. */
-    if (!ul || !vl)
-        return;
 
     /* Now multiply by forming partial products and adding them to the result
      * so far. Rather than zero the low ul digits of w before starting, we
@@ -35,9 +38,197 @@ void _apm_mul_base(const apm_digit *u,
     }
 }
 
-/* TODO: switch to Schönhage–Strassen algorithm
- * https://en.wikipedia.org/wiki/Sch%C3%B6nhage%E2%80%93Strassen_algorithm
+static void apm_mul_n(const apm_digit *u,
+                      const apm_digit *v,
+                      apm_size size,
+                      apm_digit *w,
+                      apm_digit *scratch);
+
+/* Return the number of scratch digits apm_mul_n needs for size-digit operands,
+ * counting those of the recursive calls. The calls of one level run one after
+ * another and share the same scratch; a call that apm_fork hands to another
+ * CPU allocates its own.
  */
+static size_t apm_mul_scratch(apm_size size)
+{
+    if (size < KARATSUBA_MUL_THRESHOLD)
+        return 0;
+    if (size >= TOOM3_MUL_THRESHOLD) {
+        const apm_size k = (size + 2) / 3;
+        return 14 * (size_t)(k + 1) + apm_mul_scratch(k + 1);
+    }
+    const apm_size even_size = size & ~1;
+    return 2 * (size_t) even_size + apm_mul_scratch(even_size / 2);
+}
+
+/* Set u[size] = u[size] / 3, where u is known to be a multiple of 3. */
+static void apm_divexact3i(apm_digit *u, apm_size size)
+{
+    /* inv3 * 3 = 1 modulo 2^APM_DIGIT_BITS */
+    const apm_digit inv3 = APM_DIGIT_MAX / 3 * 2 + 1;
+    apm_digit cy = 0;
+    while (size--) {
+        const apm_digit ud = *u;
+        const apm_digit x = ud - cy;
+        cy = x > ud;
+        const apm_digit q = x * inv3;
+        *u++ = q;
+        /* Add the high digit of q * 3. */
+        cy += (q > APM_DIGIT_MAX / 3) + (q > APM_DIGIT_MAX / 3 * 2);
+    }
+    ASSERT(cy == 0);
+}
+
+/* Evaluate U = U2*x^2 + U1*x + U0, with U0 and U1 of k digits and U2 of top
+ * digits, at 1, -1 and 2 into p1, pm1 and p2 of k+1 digits each. pm1 gets
+ * the absolute value of U(-1); return whether it is negative.
+ */
+bool _apm_toom3_eval(const apm_digit *u,
+                     apm_size k,
+                     apm_size top,
+                     apm_digit *p1,
+                     apm_digit *pm1,
+                     apm_digit *p2)
+{
+    const apm_digit *u0 = u, *u1 = u + k, *u2 = u + 2 * k;
+
+    /* p1 = U0 + U2 */
+    apm_copy(u0, k, p1);
+    p1[k] = apm_addi(p1, k, u2, top);
+    /* pm1 = |U0 + U2 - U1| */
+    const bool neg = !p1[k] && apm_cmp_n(p1, u1, k) < 0;
+    if (neg) {
+        apm_sub_n(u1, p1, k, pm1);
+        pm1[k] = 0;
+    } else {
+        pm1[k] = p1[k] - apm_sub_n(p1, u1, k, pm1);
+    }
+    /* p1 = U0 + U1 + U2 */
+    p1[k] += apm_addi_n(p1, u1, k);
+    /* p2 = (U2 * 2 + U1) * 2 + U0 */
+    apm_copy(u2, top, p2);
+    apm_zero(p2 + top, k + 1 - top);
+    apm_lshifti(p2, k + 1, 1);
+    apm_addi(p2, k + 1, u1, k);
+    apm_lshifti(p2, k + 1, 1);
+    apm_addi(p2, k + 1, u0, k);
+    return neg;
+}
+
+/* Interpolate the Toom-3 product of two size-digit numbers split at k digits
+ * into w, given w0 = W(0) in w[0..2k-1], w4 = W(inf) in w[4k..2*size-1], and
+ * r1 = W(1), rm1 = |W(-1)|, r2 = W(2) of 2k+2 digits each, with neg the sign
+ * of W(-1). r1, rm1, r2 and t[2k+2] are overwritten.
+ */
+void _apm_toom3_interp(apm_digit *w,
+                       apm_size size,
+                       apm_size k,
+                       apm_digit *r1,
+                       apm_digit *rm1,
+                       apm_digit *r2,
+                       bool neg,
+                       apm_digit *t)
+{
+    const apm_size top = size - 2 * k;
+    const apm_size len = 2 * (k + 1);
+    const apm_digit *w0 = w, *w4 = w + 4 * k;
+
+    /* sum = (W(1) + W(-1)) / 2; diff = (W(1) - W(-1)) / 2 = w1 + w3. */
+    apm_digit *sum = t, *diff = rm1;
+    apm_add_n(r1, rm1, len, t);
+    apm_sub_n(r1, rm1, len, rm1);
+    if (neg)
+        SWAP(sum, diff);
+    apm_rshifti(sum, len, 1);
+    apm_rshifti(diff, len, 1);
+
+    /* sum = w2 */
+    apm_subi(sum, len, w0, 2 * k);
+    apm_subi(sum, len, w4, 2 * top);
+
+    /* r2 = (W(2) - w0 - 16*w4 - 4*w2) / 2 = w1 + 4*w3, using r1 for the
+     * multiples. */
+    apm_subi(r2, len, w0, 2 * k);
+    r1[2 * top] = apm_lshift(w4, 2 * top, 4, r1);
+    apm_subi(r2, len, r1, 2 * top + 1);
+    apm_lshift(sum, len, 2, r1);
+    apm_subi_n(r2, r1, len);
+    apm_rshifti(r2, len, 1);
+
+    /* r2 = w3; diff = w1. */
+    apm_subi_n(r2, diff, len);
+    apm_divexact3i(r2, len);
+    apm_subi_n(diff, r2, len);
+
+    /* w0 and w4 are in place; add w1, w2 and w3 in between. */
+    apm_zero(w + 2 * k, 2 * k);
+    ASSERT(apm_addi(w + k, 2 * size - k, diff, apm_rsize(diff, len)) == 0);
+    ASSERT(apm_addi(w + 2 * k, 2 * size - 2 * k, sum, apm_rsize(sum, len)) ==
+           0);
+    ASSERT(apm_addi(w + 3 * k, 2 * size - 3 * k, r2, apm_rsize(r2, len)) ==
+           0);
+}
+
+/* Toom-3 multiplication [cf. Bodrato and Zanoni, ISSAC 2007]
+ * Given U = U2*x^2 + U1*x + U0 and V = V2*x^2 + V1*x + V0, where x = 2^kN,
+ * the product W = w4*x^4 + w3*x^3 + w2*x^2 + w1*x + w0 follows from its values
+ * at 0, 1, -1, 2 and infinity, which are products of k+1 digit numbers:
+ * w0 = W(0), w4 = W(inf)
+ * w1 + w3 = (W(1) - W(-1)) / 2
+ * w2 = (W(1) + W(-1)) / 2 - w0 - w4
+ * w1 + 4*w3 = (W(2) - w0 - 4*w2 - 16*w4) / 2
+ * w3 = ((w1 + 4*w3) - (w1 + w3)) / 3
+ * This takes five multiplications of a third of the size, against the nine
+ * two levels of Karatsuba would take.
+ */
+static void apm_toom3_n(const apm_digit *u,
+                        const apm_digit *v,
+                        apm_size size,
+                        apm_digit *w,
+                        apm_digit *scratch)
+{
+    const apm_size k = (size + 2) / 3;
+    const apm_size top = size - 2 * k; /* Size of U2 and V2. */
+    const apm_size len = 2 * (k + 1);  /* Size of W(1), W(-1) and W(2). */
+
+    apm_digit *tmp = scratch;
+    scratch += 6 * (k + 1) + 4 * len;
+    const size_t scratch_size = apm_mul_scratch(k + 1);
+    apm_digit *p1 = tmp, *pm1 = p1 + k + 1, *p2 = pm1 + k + 1;
+    apm_digit *q1 = p2 + k + 1, *qm1 = q1 + k + 1, *q2 = qm1 + k + 1;
+    apm_digit *r1 = q2 + k + 1, *rm1 = r1 + len, *r2 = rm1 + len;
+    apm_digit *t = r2 + len;
+
+    bool neg = _apm_toom3_eval(u, k, top, p1, pm1, p2);
+    neg ^= _apm_toom3_eval(v, k, top, q1, qm1, q2);
+
+    /* W(0) => w[0..2k-1]; W(inf) => w[4k..2*size-1];
+     * W(1) => r1; |W(-1)| => rm1; W(2) => r2.
+     * The products are independent, so all but the last may run on other
+     * CPUs.
+     */
+    apm_digit *w0 = w, *w4 = w + 4 * k;
+    struct apm_task tasks[] = {
+        {.fn = apm_mul_n, .u = u, .v = v, .size = k, .w = w0},
+        {.fn = apm_mul_n,
+         .u = u + 2 * k,
+         .v = v + 2 * k,
+         .size = top,
+         .w = w4},
+        {.fn = apm_mul_n, .u = p1, .v = q1, .size = k + 1, .w = r1},
+        {.fn = apm_mul_n, .u = p2, .v = q2, .size = k + 1, .w = r2},
+    };
+    for (int i = 0; i < ARRAY_SIZE(tasks); i++) {
+        tasks[i].scratch = scratch;
+        tasks[i].scratch_size = scratch_size;
+        apm_fork(&tasks[i]);
+    }
+    apm_mul_n(pm1, qm1, k + 1, rm1, scratch);
+    for (int i = 0; i < ARRAY_SIZE(tasks); i++)
+        apm_join(&tasks[i]);
+
+    _apm_toom3_interp(w, size, k, r1, rm1, r2, neg, t);
+}
 
 /* Karatsuba multiplication [cf. Knuth 4.3.3, vol.2, 3rd ed, pp.294-295]
  * Given U = U1*2^N + U0 and V = V1*2^N + V0,
@@ -53,18 +244,16 @@ void _apm_mul_base(const apm_digit *u,
 static void apm_mul_n(const apm_digit *u,
                       const apm_digit *v,
                       apm_size size,
-                      apm_digit *w)
+                      apm_digit *w,
+                      apm_digit *scratch)
 {
-    /* TODO: Only allocate a temporary buffer which is large enough for all
-     * following recursive calls, rather than allocating at each call.
-     */
-    if (u == v) {
-        apm_sqr(u, size, w);
+    if (size < KARATSUBA_MUL_THRESHOLD) {
+        _apm_mul_base(u, size, v, size, w);
         return;
     }
 
-    if (size < KARATSUBA_MUL_THRESHOLD) {
-        _apm_mul_base(u, size, v, size, w);
+    if (size >= TOOM3_MUL_THRESHOLD) {
+        apm_toom3_n(u, v, size, w, scratch);
         return;
     }
 
@@ -76,60 +265,69 @@ static void apm_mul_n(const apm_digit *u,
     const apm_digit *v0 = v, *v1 = v + half_size;
     apm_digit *w0 = w, *w1 = w + even_size;
 
-    /* U0 * V0 => w[0..even_size-1]; */
-    /* U1 * V1 => w[even_size..2*even_size-1]. */
-    if (half_size >= KARATSUBA_MUL_THRESHOLD) {
-        apm_mul_n(u0, v0, half_size, w0);
-        apm_mul_n(u1, v1, half_size, w1);
-    } else {
-        _apm_mul_base(u0, half_size, v0, half_size, w0);
-        _apm_mul_base(u1, half_size, v1, half_size, w1);
-    }
-
-    /* Since we cannot add w[0..even_size-1] to w[half_size ...
-     * half_size+even_size-1] in place, we have to make a copy of it now.
-     * This later gets used to store U1-U0 and V0-V1.
+    /* Get absolute values of U1-U0 and V0-V1 into tmp[0..even_size-1]; their
+     * product goes to mid, tmp[even_size..2*even_size-1].
      */
-    apm_digit *tmp = APM_TMP_COPY(w0, even_size);
-
-    apm_digit cy;
-    /* w[half_size..half_size+even_size-1] += U1*V1. */
-    cy = apm_addi_n(w + half_size, w1, even_size);
-    /* w[half_size..half_size+even_size-1] += U0*V0. */
-    cy += apm_addi_n(w + half_size, tmp, even_size);
-
-    /* Get absolute value of U1-U0. */
-    apm_digit *u_tmp = tmp;
+    apm_digit *tmp = scratch;
+    apm_digit *u_tmp = tmp, *v_tmp = tmp + half_size, *mid = tmp + even_size;
+    scratch += even_size * 2;
     bool prod_neg = apm_cmp_n(u1, u0, half_size) < 0;
     if (prod_neg)
         apm_sub_n(u0, u1, half_size, u_tmp);
     else
         apm_sub_n(u1, u0, half_size, u_tmp);
-
-    /* Get absolute value of V0-V1. */
-    apm_digit *v_tmp = tmp + half_size;
     if (apm_cmp_n(v0, v1, half_size) < 0)
         apm_sub_n(v1, v0, half_size, v_tmp), prod_neg ^= 1;
     else
         apm_sub_n(v0, v1, half_size, v_tmp);
 
-    /* tmp = (U1-U0)*(V0-V1). */
-    tmp = APM_TMP_ALLOC(even_size);
-    if (half_size >= KARATSUBA_MUL_THRESHOLD)
-        apm_mul_n(u_tmp, v_tmp, half_size, tmp);
-    else
-        _apm_mul_base(u_tmp, half_size, v_tmp, half_size, tmp);
-    APM_TMP_FREE(u_tmp);
+    /* The three products are independent, so the first two may run on other
+     * CPUs while this one does the third.
+     * U0 * V0 => w[0..even_size-1];
+     * U1 * V1 => w[even_size..2*even_size-1];
+     * (U1-U0)*(V0-V1) => mid.
+     */
+    const size_t scratch_size = apm_mul_scratch(half_size);
+    struct apm_task t0 = {.fn = apm_mul_n,
+                          .u = u0,
+                          .v = v0,
+                          .size = half_size,
+                          .w = w0,
+                          .scratch = scratch,
+                          .scratch_size = scratch_size};
+    struct apm_task t1 = {.fn = apm_mul_n,
+                          .u = u1,
+                          .v = v1,
+                          .size = half_size,
+                          .w = w1,
+                          .scratch = scratch,
+                          .scratch_size = scratch_size};
+    apm_fork(&t0);
+    apm_fork(&t1);
+    apm_mul_n(u_tmp, v_tmp, half_size, mid, scratch);
+    apm_join(&t0);
+    apm_join(&t1);
+
+    /* Since we cannot add w[0..even_size-1] to w[half_size ...
+     * half_size+even_size-1] in place, we have to make a copy of it now,
+     * over U1-U0 and V0-V1.
+     */
+    apm_copy(w0, even_size, tmp);
+
+    apm_digit cy;
+    /* w[half_size..half_size+even_size-1] += U1*V1. */
+    cy = apm_addi_n(w + half_size, w1, even_size);
+    /* w[half_size..half_size+even_size-1] += U0*V0. */
+    cy += apm_addi_n(w + half_size, tmp, even_size);
 
     /* Now add / subtract (U1-U0)*(V0-V1) from
      * w[half_size..half_size+even_size-1] based on whether it is negative or
      * positive.
      */
     if (prod_neg)
-        cy -= apm_subi_n(w + half_size, tmp, even_size);
+        cy -= apm_subi_n(w + half_size, mid, even_size);
     else
-        cy += apm_addi_n(w + half_size, tmp, even_size);
-    APM_TMP_FREE(tmp);
+        cy += apm_addi_n(w + half_size, mid, even_size);
 
     /* Now if there was any carry from the middle digits (which is at most 2),
      * add that to w[even_size+half_size..2*even_size-1]. */
@@ -179,14 +377,36 @@ void apm_mul(const apm_digit *u,
 
     ASSERT(usize >= vsize);
 
+    if (u == v) {
+        apm_sqr(u, usize, w);
+        return;
+    }
+
     if (vsize < KARATSUBA_MUL_THRESHOLD) {
         _apm_mul_base(u, usize, v, vsize, w);
         return;
     }
 
-    apm_mul_n(u, v, vsize, w);
-    if (usize == vsize)
+#ifdef NTT_MUL_THRESHOLD
+    if (vsize >= NTT_MUL_THRESHOLD && apm_mul_ntt(u, usize, v, vsize, w))
         return;
+#endif
+
+    /* One scratch area serves every level of the recursion. Unbalanced
+     * operands also keep the partial products in front of it. */
+    const size_t scratch_size = apm_mul_scratch(vsize);
+    const size_t tmp_size = usize == vsize ? 0 : vsize * 2;
+    apm_digit *tmp = NULL, *scratch = NULL;
+    if (tmp_size + scratch_size) {
+        tmp = APM_TMP_ALLOC(tmp_size + scratch_size);
+        scratch = tmp + tmp_size;
+    }
+
+    apm_mul_n(u, v, vsize, w, scratch);
+    if (usize == vsize) {
+        APM_TMP_FREE(tmp);
+        return;
+    }
 
     apm_size wsize = usize + vsize;
     apm_zero(w + (vsize * 2), wsize - (vsize * 2));
@@ -195,22 +415,16 @@ void apm_mul(const apm_digit *u,
     u += vsize;
     usize -= vsize;
 
-    apm_digit *tmp = NULL;
-    if (usize >= vsize) {
-        tmp = APM_TMP_ALLOC(vsize * 2);
-        do {
-            apm_mul_n(u, v, vsize, tmp);
-            ASSERT(apm_addi(w, wsize, tmp, vsize * 2) == 0);
-            w += vsize;
-            wsize -= vsize;
-            u += vsize;
-            usize -= vsize;
-        } while (usize >= vsize);
+    while (usize >= vsize) {
+        apm_mul_n(u, v, vsize, tmp, scratch);
+        ASSERT(apm_addi(w, wsize, tmp, vsize * 2) == 0);
+        w += vsize;
+        wsize -= vsize;
+        u += vsize;
+        usize -= vsize;
     }
 
     if (usize) { /* Size of U isn't a multiple of size of V. */
-        if (!tmp)
-            tmp = APM_TMP_ALLOC(usize + vsize);
         /* Now usize < vsize. Rearrange operands. */
         if (usize < KARATSUBA_MUL_THRESHOLD)
             _apm_mul_base(v, vsize, u, usize, tmp);
@@ -1,20 +1,30 @@
+#include <linux/math64.h>
+#include <linux/mm.h>
+
 #include "mybignum.h"
 
 
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 bignum *my_bn_init(size_t size)
 {
     // create bn obj
     bignum *new_bn = kmalloc(sizeof(bignum), GFP_KERNEL);
+    if (!new_bn)
+        return NULL;
 
     // init data
-    new_bn->number = kmalloc(size, GFP_KERNEL);
-    memset(new_bn->number, 0, size);
+    new_bn->number = kcalloc(size, sizeof(*new_bn->number), GFP_KERNEL);
+    if (!new_bn->number) {
+        kfree(new_bn);
+        return NULL;
+    }
 
     // init size and sign
     new_bn->size = size;
+    new_bn->capacity = size;
     new_bn->sign = 0;
 
     return new_bn;
@@ -23,22 +33,18 @@ bignum *my_bn_init(size_t size)
 // create bignum from int
 bignum *my_bn_from_int(int x)
 {
-    if (x < 10) {
+    if (x < MY_BN_BASE) {
         bignum *result = my_bn_init(1);
-        result->number[0] = x;
+        if (result)
+            result->number[0] = x;
         return result;
     }
 
-    bignum *result = my_bn_init(10);
-
-    size_t size = 0;
-
-    while (x) {
-        result->number[size] = x % 10;
-        x /= 10;
-        size++;
-    }
-    my_bn_resize(result, size);
+    bignum *result = my_bn_init(2);
+    if (!result)
+        return NULL;
+    result->number[0] = x % MY_BN_BASE;
+    result->number[1] = x / MY_BN_BASE;
     return result;
 }
 
@@ -48,69 +54,100 @@ int my_bn_resize(bignum *src, size_t size)
     if (!src)
         return -1;
 
-    if (size == src->size)
-        return 0;
-
-    if (size == 0)  // prevent krealloc(0) = kfree, which will cause problem
-        return my_bn_free(src);
-
-    src->number = krealloc(src->number, size, GFP_KERNEL);
-
-    if (!src->number)  // realloc fails
-        return -1;
+    // grow by doubling, so that a number growing a limb at a time is only
+    // reallocated a logarithmic number of times; never shrink
+    if (size > src->capacity) {
+        size_t capacity = MAX(size, 2 * (size_t) src->capacity);
+        uint32_t *number = krealloc(src->number, capacity * sizeof(*number),
+                                    GFP_KERNEL);
+        if (!number)  // realloc fails
+            return -1;
+        src->number = number;
+        src->capacity = capacity;
+    }
 
     if (size > src->size)
-        memset(src->number + src->size, 0, size - src->size);
+        memset(src->number + src->size, 0,
+               (size - src->size) * sizeof(*src->number));
 
     src->size = size;
     return 0;
 }
 
 // add two bignum and store at result
-void my_bn_add(bignum *a, bignum *b, bignum *result)
+int my_bn_add(bignum *a, bignum *b, bignum *result)
 {
     if (a->sign && !b->sign) {  // a neg, b pos, do b-a
-        return;
+        return -1;
     } else if (!a->sign && b->sign) {  // a pos, b neg, do a-b
-        return;
+        return -1;
     }
 
-    // pre caculate how many digits that result need
-    int digit_width = MAX(a->size, b->size) + 1;
-    my_bn_resize(result, digit_width);
+    // pre caculate how many limbs that result need
+    unsigned int width = MAX(a->size, b->size);
+    if (my_bn_resize(result, width + 1) < 0)
+        return -1;
 
-    unsigned char carry = 0;  // store add carry
+    uint32_t carry = 0;  // store add carry
 
-    for (int i = 0; i < digit_width - 1; i++) {
-        unsigned char temp_a = i < a->size ? a->number[i] : 0;
-        unsigned char temp_b = i < b->size ? b->number[i] : 0;
+    for (unsigned int i = 0; i < width; i++) {
+        uint32_t temp_a = i < a->size ? a->number[i] : 0;
+        uint32_t temp_b = i < b->size ? b->number[i] : 0;
 
+        // below 2 * MY_BN_BASE < 2^32
         carry += temp_a + temp_b;
 
-        result->number[i] = carry - (10 & -(carry > 9));
-        carry = carry > 9;
-    }
-
-    if (carry) {
-        result->number[digit_width - 1] = 1;
-    } else {
-        my_bn_resize(result, digit_width - 1);
+        result->number[i] = carry - (MY_BN_BASE & -(carry >= MY_BN_BASE));
+        carry = carry >= MY_BN_BASE;
     }
 
+    result->number[width] = carry;
+    result->size = width + carry;
     result->sign = a->sign;
+    return 0;
 }
 
-// bn to string
-char *my_bn_to_str(bignum *src)
+// number of limbs of src without leading zeros, at least 1
+static unsigned int my_bn_used(const bignum *src)
 {
-    size_t len = sizeof(char) * src->size + 1;
-    char *p = kmalloc(len, GFP_KERNEL);
-    memset(p, 0, len - 1);
-    int n = src->size - 1;
-    for (int i = 0; i < src->size; i++) {
-        p[i] = src->number[n - i] + '0';
+    unsigned int n = src->size;
+    while (n > 1 && !src->number[n - 1])
+        n--;
+    return n;
+}
+
+size_t my_bn_digits(const bignum *src)
+{
+    if (!src->size)
+        return 1;
+    unsigned int n = my_bn_used(src);
+    size_t digits = (size_t) (n - 1) * MY_BN_DIGITS + 1;
+    for (uint32_t top = src->number[n - 1]; top >= 10; top /= 10)
+        digits++;
+    return digits;
+}
+
+// bn to string: the top limb as it is, every other one zero-padded
+void my_bn_print(const bignum *src, char *dst)
+{
+    const size_t digits = my_bn_digits(src);
+    char *p = dst + digits;
+
+    *p = '\0';
+    for (unsigned int i = 0; p > dst; i++) {
+        uint32_t limb = i < src->size ? src->number[i] : 0;
+        for (int j = 0; j < MY_BN_DIGITS && p > dst; j++) {
+            *--p = '0' + limb % 10;
+            limb /= 10;
+        }
     }
+}
 
+char *my_bn_to_str(bignum *src)
+{
+    char *p = kmalloc(my_bn_digits(src) + 1, GFP_KERNEL);
+    if (p)
+        my_bn_print(src, p);
     return p;
 }
 
@@ -131,6 +168,146 @@ void my_bn_swap(bignum *a, bignum *b)
     *b = tmp;
 }
 
+/* Multiplication of limb arrays in base MY_BN_BASE. A limb product plus two
+ * limbs stays below 2^64, so every step carries through a u64.
+ */
+
+// operands from here on are multiplied by Karatsuba's method; the halves
+// plus a carry limb have to be shorter than the operands, so at least 4
+#ifndef MY_BN_KARATSUBA_THRESHOLD
+#define MY_BN_KARATSUBA_THRESHOLD 32
+#endif
+#if MY_BN_KARATSUBA_THRESHOLD < 4
+#error "MY_BN_KARATSUBA_THRESHOLD must be at least 4"
+#endif
+
+// r[an + bn] = a[an] * b[bn]
+static void my_bn_mul_base(const uint32_t *a,
+                           unsigned int an,
+                           const uint32_t *b,
+                           unsigned int bn,
+                           uint32_t *r)
+{
+    memset(r, 0, (an + bn) * sizeof(*r));
+    for (unsigned int i = 0; i < an; i++) {
+        u32 carry = 0;
+        for (unsigned int j = 0; j < bn; j++) {
+            u64 t = (u64) a[i] * b[j] + r[i + j] + carry;
+            carry = div_u64_rem(t, MY_BN_BASE, &r[i + j]);
+        }
+        r[i + bn] = carry;
+    }
+}
+
+// r[rn] += x[xn], xn <= rn, carrying up to r[rn - 1]
+static void my_bn_addi(uint32_t *r,
+                       unsigned int rn,
+                       const uint32_t *x,
+                       unsigned int xn)
+{
+    u32 carry = 0;
+    for (unsigned int i = 0; i < rn && (i < xn || carry); i++) {
+        carry += r[i] + (i < xn ? x[i] : 0);
+        r[i] = carry - (MY_BN_BASE & -(carry >= MY_BN_BASE));
+        carry = carry >= MY_BN_BASE;
+    }
+}
+
+// r[rn] -= x[xn], xn <= rn, for r >= x
+static void my_bn_subi(uint32_t *r,
+                       unsigned int rn,
+                       const uint32_t *x,
+                       unsigned int xn)
+{
+    u32 borrow = 0;
+    for (unsigned int i = 0; i < rn && (i < xn || borrow); i++) {
+        u32 t = r[i] - (i < xn ? x[i] : 0) - borrow;
+        borrow = t >= MY_BN_BASE;  // wrapped around
+        r[i] = t + (MY_BN_BASE & -borrow);
+    }
+}
+
+// limbs of scratch my_bn_kmul needs for n-limb operands
+static size_t my_bn_kmul_scratch(unsigned int n)
+{
+    if (n < MY_BN_KARATSUBA_THRESHOLD)
+        return 0;
+    unsigned int h = n - n / 2 + 1;
+    return 4 * h + my_bn_kmul_scratch(h);
+}
+
+/* r[2n] = a[n] * b[n]. With a = a1 B^m + a0 and b = b1 B^m + b0,
+ * a * b = a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0
+ */
+static void my_bn_kmul(const uint32_t *a,
+                       const uint32_t *b,
+                       unsigned int n,
+                       uint32_t *r,
+                       uint32_t *scratch)
+{
+    if (n < MY_BN_KARATSUBA_THRESHOLD) {
+        my_bn_mul_base(a, n, b, n, r);
+        return;
+    }
+
+    const unsigned int m = n / 2, h = n - m;
+    uint32_t *sa = scratch, *sb = sa + h + 1, *z1 = sb + h + 1;
+
+    my_bn_kmul(a, b, m, r, scratch);  // a0 b0
+    my_bn_kmul(a + m, b + m, h, r + 2 * m, scratch);  // a1 b1
+
+    memcpy(sa, a + m, h * sizeof(*sa));
+    sa[h] = 0;
+    my_bn_addi(sa, h + 1, a, m);
+    memcpy(sb, b + m, h * sizeof(*sb));
+    sb[h] = 0;
+    my_bn_addi(sb, h + 1, b, m);
+    my_bn_kmul(sa, sb, h + 1, z1, z1 + 2 * (h + 1));
+    my_bn_subi(z1, 2 * (h + 1), r, 2 * m);
+    my_bn_subi(z1, 2 * (h + 1), r + 2 * m, 2 * h);
+
+    // the middle term is below B^(n + 1), so its top limbs are zero
+    my_bn_addi(r + m, 2 * n - m, z1, MIN(2 * (h + 1), 2 * n - m));
+}
+
+// result = a * b, where result is neither a nor b
+int my_bn_mul(bignum *a, bignum *b, bignum *result)
+{
+    const unsigned int an = my_bn_used(a), bn = my_bn_used(b);
+
+    if (!a->size || !b->size) {
+        if (my_bn_resize(result, 1) < 0)
+            return -1;
+        result->number[0] = 0;
+        return 0;
+    }
+    if (my_bn_resize(result, an + bn) < 0)
+        return -1;
+
+    if (MIN(an, bn) < MY_BN_KARATSUBA_THRESHOLD) {
+        my_bn_mul_base(a->number, an, b->number, bn, result->number);
+    } else {
+        // the shorter operand is padded with zeros to the longer one
+        const unsigned int n = MAX(an, bn);
+        uint32_t *buf = kvmalloc_array(
+            4 * n + my_bn_kmul_scratch(n), sizeof(*buf), GFP_KERNEL);
+        if (!buf)
+            return -1;
+        uint32_t *pa = buf, *pb = pa + n, *r = pb + n;
+
+        memcpy(pa, a->number, an * sizeof(*pa));
+        memset(pa + an, 0, (n - an) * sizeof(*pa));
+        memcpy(pb, b->number, bn * sizeof(*pb));
+        memset(pb + bn, 0, (n - bn) * sizeof(*pb));
+        my_bn_kmul(pa, pb, n, r, r + 2 * n);
+        memcpy(result->number, r, (an + bn) * sizeof(*r));
+        kvfree(buf);
+    }
+    result->size = my_bn_used(result);
+    result->sign = a->sign ^ b->sign;
+    return 0;
+}
+
 /*int my_bn_cpy(bignum *dest, bignum *src)
 {
     if (my_bn_resize(dest, src->size) < 0)
@@ -140,25 +317,78 @@ void my_bn_swap(bignum *a, bignum *b)
     return 0;
 }*/
 
-void my_bn_fib_sequence(long long k, bignum *dest)
+int my_bn_fib_sequence(long long k, bignum *dest)
 {
-    my_bn_resize(dest, 1);
+    if (my_bn_resize(dest, 1) < 0)
+        return -1;
 
     if (k < 2) {
         dest->number[0] = k;
-        return;
+        return 0;
     }
 
     bignum *a = my_bn_from_int(0);
     bignum *b = my_bn_from_int(1);
+    int rc = a && b ? 0 : -1;
     dest->number[0] = 1;
 
-    for (int i = 2; i <= k; i++) {
+    for (int i = 2; i <= k && !rc; i++) {
         my_bn_swap(b, dest);
-        my_bn_add(a, b, dest);
+        rc = my_bn_add(a, b, dest);
         my_bn_swap(a, b);
     }
 
     my_bn_free(a);
     my_bn_free(b);
+    return rc;
+}
+
+/* F(k) by fast doubling on decimal limbs, so that it needs no conversion to
+ * be printed. With a = F(m - 1) and b = F(m), the identities
+ * F(2m - 1) = F(m)^2 + F(m - 1)^2
+ * F(2m) = F(m) * (F(m) + 2 F(m - 1))
+ * double m without the subtraction of the usual form. Return -1, leaving dest
+ * undefined, if memory runs out.
+ */
+int my_bn_fib_fastdoubling(long long k, bignum *dest)
+{
+    if (my_bn_resize(dest, 1) < 0)
+        return -1;
+
+    if (k < 2) {
+        dest->number[0] = k;
+        return 0;
+    }
+
+    bignum *a = my_bn_from_int(0);  // F(m - 1)
+    bignum *b = my_bn_from_int(1);  // F(m), m = 1
+    bignum *t1 = my_bn_init(1);
+    bignum *t2 = my_bn_init(1);
+    int rc = a && b && t1 && t2 ? 0 : -1;
+
+    for (long long mask = 1LL << (62 - __builtin_clzll(k)); mask && !rc;
+         mask >>= 1) {
+        if (my_bn_add(a, a, t1) || my_bn_add(t1, b, t2) ||
+            my_bn_mul(b, t2, t1) ||  // F(2m)
+            my_bn_mul(b, b, t2) || my_bn_mul(a, a, b) ||
+            my_bn_add(t2, b, a)) {  // F(2m - 1)
+            rc = -1;
+            break;
+        }
+
+        if (mask & k) {  // m = 2m + 1
+            rc = my_bn_add(a, t1, b);
+            my_bn_swap(a, t1);
+        } else {  // m = 2m
+            my_bn_swap(b, t1);
+        }
+    }
+
+    if (!rc)
+        my_bn_swap(dest, b);
+    my_bn_free(a);
+    my_bn_free(b);
+    my_bn_free(t1);
+    my_bn_free(t2);
+    return rc;
 }
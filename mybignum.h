@@ -5,27 +5,38 @@
 #include <linux/string.h>
 #include <linux/types.h>
 
+// each limb holds MY_BN_DIGITS decimal digits
+#define MY_BN_BASE 1000000000U
+#define MY_BN_DIGITS 9
+
 typedef struct __bignum {
-    unsigned char *number;  // store num by 1byte int
-    unsigned int size;      // data length
+    uint32_t *number;       // limbs in base MY_BN_BASE, least significant first
+    unsigned int size;      // limbs in use
+    unsigned int capacity;  // limbs allocated
     int sign;               // 0:negative ,1:positive
 } bignum;
 
-// create bignum
+// create bignum of value 0 in size limbs, NULL if out of memory
 bignum *my_bn_init(size_t size);
 
 // create bignum from int
 bignum *my_bn_from_int(int x);
 
-// resize bignum to target size
+// resize bignum to target size in limbs, zeroing new limbs
 int my_bn_resize(bignum *src, size_t size);
 
-// add two bignum
-void my_bn_add(bignum *a, bignum *b, bignum *result);
+// add two bignum of the same sign, -1 on failure
+int my_bn_add(bignum *a, bignum *b, bignum *result);
 
 // bn to string
 char *my_bn_to_str(bignum *src);
 
+// number of decimal digits of src
+size_t my_bn_digits(const bignum *src);
+
+// bn to string in dst, which holds my_bn_digits(src) + 1 bytes
+void my_bn_print(const bignum *src, char *dst);
+
 // free bignum
 int my_bn_free(bignum *src);
 
@@ -34,13 +45,17 @@ int my_bn_cpy(bignum *dest, bignum *src);
 
 void my_bn_swap(bignum *a, bignum *b);
 
-void my_bn_fib_sequence(long long k, bignum *dest);
+// F(k) by iteration, -1 if out of memory
+int my_bn_fib_sequence(long long k, bignum *dest);
+
+// F(k) by fast doubling on top of my_bn_mul, -1 if out of memory
+int my_bn_fib_fastdoubling(long long k, bignum *dest);
 
 // result = a / b
 void my_bn_divid(bignum *a, bignum *b, bignum *result);
 
-// result = a * b
-void my_bn_mul(bignum *a, bignum *b, bignum *result);
+// result = a * b, -1 if out of memory
+int my_bn_mul(bignum *a, bignum *b, bignum *result);
 
 
 #endif
\ No newline at end of file
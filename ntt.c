@@ -0,0 +1,281 @@
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+
+#include "apm.h"
+
+#ifdef NTT_MUL_THRESHOLD
+
+/* Multiplication by number theoretic transforms [cf. Knuth 4.3.3, vol.2,
+ * 3rd ed, pp.305-311]
+ * The digits of U and V are the coefficients of two polynomials, whose product
+ * is found by cyclic convolution modulo three primes just below 2^62 and put
+ * back together with the Chinese remainder theorem (Garner's algorithm). Every
+ * coefficient of the product is below N * 2^128 for a transform of length N,
+ * far less than the product of the primes.
+ *
+ * Arithmetic modulo p is done in Montgomery form with R = 2^64, so that it
+ * needs 128-bit multiplication but never a 128-bit division.
+ */
+
+typedef unsigned __int128 ntt_dword;
+
+/* Primes c * 2^40 + 1 below 2^62, and a primitive root of each. They allow
+ * transforms of up to 2^40 points.
+ */
+static const struct {
+    uint64_t p, g;
+} ntt_primes[3] = {
+    {0x3fffc00000000001ULL, 11},
+    {0x3fffbe0000000001ULL, 3},
+    {0x3fff840000000001ULL, 19},
+};
+
+struct ntt_mod {
+    uint64_t p;
+    uint64_t pinv; /* -1 / p modulo R */
+    uint64_t one;  /* R modulo p */
+    uint64_t r2;   /* R^2 modulo p */
+};
+
+static inline uint64_t ntt_add(const struct ntt_mod *m, uint64_t a, uint64_t b)
+{
+    const uint64_t s = a + b;
+    return s >= m->p ? s - m->p : s;
+}
+
+static inline uint64_t ntt_sub(const struct ntt_mod *m, uint64_t a, uint64_t b)
+{
+    return a >= b ? a - b : a + m->p - b;
+}
+
+/* Return a * b / R modulo p. */
+static inline uint64_t ntt_mul(const struct ntt_mod *m, uint64_t a, uint64_t b)
+{
+    const ntt_dword t = (ntt_dword) a * b;
+    const uint64_t q = (uint64_t) t * m->pinv;
+    const uint64_t r = (t + (ntt_dword) q * m->p) >> 64;
+    return r >= m->p ? r - m->p : r;
+}
+
+/* Return a * R modulo p. */
+static inline uint64_t ntt_to_mont(const struct ntt_mod *m, uint64_t a)
+{
+    return ntt_mul(m, a, m->r2);
+}
+
+/* Return a^e in Montgomery form, for a in Montgomery form. */
+static uint64_t ntt_pow(const struct ntt_mod *m, uint64_t a, uint64_t e)
+{
+    uint64_t r = m->one;
+    for (; e; e >>= 1) {
+        if (e & 1)
+            r = ntt_mul(m, r, a);
+        a = ntt_mul(m, a, a);
+    }
+    return r;
+}
+
+static void ntt_mod_init(struct ntt_mod *m, uint64_t p)
+{
+    /* Newton's iteration doubles the correct low bits of 1 / p, starting
+     * from the three bits that p itself gets right. */
+    uint64_t inv = p;
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - p * inv;
+    m->p = p;
+    m->pinv = -inv;
+    m->one = -p % p;
+    m->r2 = m->one;
+    for (int i = 0; i < 64; i++)
+        m->r2 = ntt_add(m, m->r2, m->r2);
+}
+
+/* Set tw[j] = w^j for j < half, all in Montgomery form. */
+static void ntt_roots(const struct ntt_mod *m,
+                      uint64_t w,
+                      size_t half,
+                      uint64_t *tw)
+{
+    tw[0] = m->one;
+    for (size_t j = 1; j < half; j++)
+        tw[j] = ntt_mul(m, tw[j - 1], w);
+}
+
+/* Transform a[n] by decimation in frequency, leaving the result in bit
+ * reversed order, with tw from ntt_roots for a root of unity of order n.
+ */
+static void ntt_forward(const struct ntt_mod *m,
+                        uint64_t *a,
+                        size_t n,
+                        const uint64_t *tw)
+{
+    for (size_t h = n / 2, s = 1; h; h >>= 1, s <<= 1) {
+        for (size_t i = 0; i < n; i += 2 * h) {
+            for (size_t j = 0; j < h; j++) {
+                const uint64_t x = a[i + j], y = a[i + j + h];
+                a[i + j] = ntt_add(m, x, y);
+                a[i + j + h] = ntt_mul(m, ntt_sub(m, x, y), tw[j * s]);
+            }
+        }
+    }
+}
+
+/* Transform a[n] back from bit reversed order by decimation in time, with tw
+ * for the inverse root of unity. The result is n times too large.
+ */
+static void ntt_inverse(const struct ntt_mod *m,
+                        uint64_t *a,
+                        size_t n,
+                        const uint64_t *tw)
+{
+    for (size_t h = 1, s = n / 2; h < n; h <<= 1, s >>= 1) {
+        for (size_t i = 0; i < n; i += 2 * h) {
+            for (size_t j = 0; j < h; j++) {
+                const uint64_t x = a[i + j];
+                const uint64_t y = ntt_mul(m, a[i + j + h], tw[j * s]);
+                a[i + j] = ntt_add(m, x, y);
+                a[i + j + h] = ntt_sub(m, x, y);
+            }
+        }
+    }
+}
+
+static void ntt_load(const struct ntt_mod *m,
+                     const apm_digit *u,
+                     apm_size usize,
+                     size_t n,
+                     uint64_t *a)
+{
+    for (apm_size i = 0; i < usize; i++)
+        a[i] = u[i] % m->p;
+    memset(a + usize, 0, (n - usize) * sizeof(*a));
+}
+
+/* Set a[n] to the cyclic convolution of u[usize] and v[vsize] modulo the
+ * prime, using b[n] and tw[n/2] as scratch. b is not touched for squares.
+ */
+static void ntt_convolve(const struct ntt_mod *m,
+                         uint64_t g,
+                         const apm_digit *u,
+                         apm_size usize,
+                         const apm_digit *v,
+                         apm_size vsize,
+                         size_t n,
+                         uint64_t *a,
+                         uint64_t *b,
+                         uint64_t *tw)
+{
+    /* w is a root of unity of order n. */
+    const uint64_t w = ntt_pow(m, ntt_to_mont(m, g), (m->p - 1) / n);
+
+    ntt_roots(m, w, n / 2, tw);
+    ntt_load(m, u, usize, n, a);
+    ntt_forward(m, a, n, tw);
+    if (u == v && usize == vsize) {
+        b = a;
+    } else {
+        ntt_load(m, v, vsize, n, b);
+        ntt_forward(m, b, n, tw);
+    }
+
+    /* Each pointwise product comes out divided by R, which the final scaling
+     * by R / n makes up for along with the factor n of the inverse.
+     */
+    for (size_t i = 0; i < n; i++)
+        a[i] = ntt_mul(m, a[i], b[i]);
+    ntt_roots(m, ntt_pow(m, w, n - 1), n / 2, tw);
+    ntt_inverse(m, a, n, tw);
+
+    const uint64_t ninv = m->p - (m->p - 1) / n;
+    const uint64_t scale = ntt_to_mont(m, ntt_to_mont(m, ninv));
+    for (size_t i = 0; i < n; i++)
+        a[i] = ntt_mul(m, a[i], scale);
+}
+
+bool apm_mul_ntt(const apm_digit *u,
+                 apm_size usize,
+                 const apm_digit *v,
+                 apm_size vsize,
+                 apm_digit *w)
+{
+    const size_t wsize = (size_t) usize + vsize;
+    size_t n = 1;
+    while (n < wsize - 1)
+        n <<= 1;
+    if (n < 2)
+        n = 2;
+
+    /* The callers fall back on Toom-3 if this fails, as it does beyond the
+     * INT_MAX bytes kvmalloc serves, so no warning is wanted.
+     */
+    const bool sqr = u == v && usize == vsize;
+    uint64_t *c = kvmalloc_array((sqr ? 3 : 4) * n + n / 2, sizeof(*c),
+                                 GFP_KERNEL | __GFP_NOWARN);
+    if (!c)
+        return false;
+    uint64_t *c1 = c, *c2 = c1 + n, *c3 = c2 + n, *tw = c3 + n;
+    uint64_t *b = sqr ? NULL : tw + n / 2;
+
+    struct ntt_mod m1, m2, m3;
+    ntt_mod_init(&m1, ntt_primes[0].p);
+    ntt_mod_init(&m2, ntt_primes[1].p);
+    ntt_mod_init(&m3, ntt_primes[2].p);
+    ntt_convolve(&m1, ntt_primes[0].g, u, usize, v, vsize, n, c1, b, tw);
+    ntt_convolve(&m2, ntt_primes[1].g, u, usize, v, vsize, n, c2, b, tw);
+    ntt_convolve(&m3, ntt_primes[2].g, u, usize, v, vsize, n, c3, b, tw);
+
+    /* With p1 > p2 > p3, all within a factor of 2, for residues r1, r2 and
+     * r3 of a coefficient x:
+     * k2 = (r2 - r1) / p1 mod p2
+     * k3 = (r3 - r1 - p1*k2) / (p1*p2) mod p3
+     * x = r1 + p1*k2 + p1*p2*k3
+     * The inverses are taken in Montgomery form, so that ntt_mul by them is
+     * a plain modular multiplication.
+     */
+    const uint64_t p1 = m1.p, p2 = m2.p, p3 = m3.p;
+    const uint64_t inv1 = ntt_pow(&m2, ntt_to_mont(&m2, p1 - p2), p2 - 2);
+    const uint64_t p1_3 = ntt_to_mont(&m3, p1 - p3);
+    const uint64_t inv12 =
+        ntt_pow(&m3, ntt_mul(&m3, p1_3, ntt_to_mont(&m3, p2 - p3)), p3 - 2);
+    const ntt_dword p12 = (ntt_dword) p1 * p2;
+    const uint64_t p12_lo = (uint64_t) p12, p12_hi = p12 >> 64;
+
+    /* Add each x into the digits of W, carrying the rest of it forward. */
+    uint64_t acc0 = 0, acc1 = 0;
+    for (size_t i = 0; i < wsize; i++) {
+        uint64_t x0 = 0, x1 = 0, x2 = 0;
+        if (i < wsize - 1) {
+            const uint64_t r1 = c1[i], r2 = c2[i], r3 = c3[i];
+            const uint64_t k2 =
+                ntt_mul(&m2, ntt_sub(&m2, r2, r1 >= p2 ? r1 - p2 : r1), inv1);
+            const uint64_t y = ntt_add(&m3, r1 >= p3 ? r1 - p3 : r1,
+                                       ntt_mul(&m3, k2 >= p3 ? k2 - p3 : k2,
+                                               p1_3));
+            const uint64_t k3 = ntt_mul(&m3, ntt_sub(&m3, r3, y), inv12);
+
+            const ntt_dword t = (ntt_dword) p1 * k2 + r1;
+            const ntt_dword lo = (ntt_dword) p12_lo * k3;
+            const ntt_dword hi = (ntt_dword) p12_hi * k3;
+            ntt_dword s = (ntt_dword)(uint64_t) t + (uint64_t) lo;
+            x0 = s;
+            s >>= 64;
+            s += (uint64_t)(t >> 64);
+            s += (uint64_t)(lo >> 64);
+            s += (uint64_t) hi;
+            x1 = s;
+            x2 = (s >> 64) + (uint64_t)(hi >> 64);
+        }
+        ntt_dword s = (ntt_dword) acc0 + x0;
+        w[i] = s;
+        s = (s >> 64) + acc1 + x1;
+        acc0 = s;
+        acc1 = (s >> 64) + x2;
+    }
+    ASSERT(acc0 == 0 && acc1 == 0);
+
+    kvfree(c);
+    return true;
+}
+
+#endif /* NTT_MUL_THRESHOLD */
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Check the cases printed by user/difftest against Python's integers.
+
+usage: difftest.py [difftest] [seed]
+"""
+
+import subprocess
+import sys
+
+if hasattr(sys, 'set_int_max_str_digits'):
+    sys.set_int_max_str_digits(0)
+
+
+def fib(n):
+    """F(n) by fast doubling."""
+    a, b = 0, 1  # F(k), F(k + 1)
+    for bit in bin(n)[2:]:
+        a, b = a * (2 * b - a), a * a + b * b
+        if bit == '1':
+            a, b = b, a + b
+    return a
+
+
+def check(fields):
+    op = fields[0]
+    if op == 'add':
+        u, v, w = (int(x, 16) for x in fields[1:])
+        return u + v == w
+    if op == 'mul':
+        u, v, w = (int(x, 16) for x in fields[1:])
+        return u * v == w
+    if op == 'sqr':
+        u, w = (int(x, 16) for x in fields[1:])
+        return u * u == w
+    if op == 'mul10':
+        u, v, w = (int(x) for x in fields[1:])
+        return u * v == w
+    if op == 'dec':
+        return int(fields[1], 16) == int(fields[2])
+    if op == 'fib':
+        return fib(int(fields[2])) == int(fields[3])
+    return False
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else './user/difftest'
+    cmd = [binary] + sys.argv[2:3]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True,
+                         universal_newlines=True).stdout
+    cases = failed = 0
+    for line in out.splitlines():
+        fields = line.split()
+        cases += 1
+        if not check(fields):
+            failed += 1
+            print('FAIL: %s' % ' '.join(f[:40] for f in fields[:3]))
+    if failed:
+        print('%d of %d cases failed' % (failed, cases))
+        sys.exit(1)
+    print('%d cases passed' % cases)
+
+
+if __name__ == '__main__':
+    main()
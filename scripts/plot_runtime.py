@@ -29,7 +29,8 @@ def main():
     datas = {}
     runtime = 50
     fib_modes = ["iteration", "fast_doubling",
-                 "clz_fast_doubling", "my_bn_iteration", "ref_bn_iteration", "ref_bn_doubling"]
+                 "clz_fast_doubling", "my_bn_iteration", "ref_bn_iteration", "ref_bn_doubling",
+                 "ref_bn_doubling_par", "my_bn_doubling"]
 
     # run program for runtime
     modes = [3, 4, 5]
@@ -1,9 +1,14 @@
 #!/usr/bin/env python3
 
+# Every line of client output starting with one of these words reports a
+# number, in decimal or 0x-prefixed hex, read through a different path.
+tags = ['Reading', 'Range', 'Mmap', 'Raw', 'Stream', 'Step', 'Submit']
+
 expect = [0, 1]
 result = []
 result_split = []
 dics = []
+seen = set()
 
 for i in range(2, 1000):
     expect.append(expect[i - 1] + expect[i - 2])
@@ -14,11 +19,16 @@ with open('out', 'r') as f:
         tmp = f.readline()
     f.close()
 for r in result:
-    if (r.find('Reading') != -1):
+    if (r.split(' ')[0] in tags):
         result_split.append(r.split(' '))
         k = int(result_split[-1][5].split(',')[0])
-        f0 = int(result_split[-1][9].split('.')[0])
+        f0 = int(result_split[-1][9].split('.')[0], 0)
         dics.append((k, f0))
+        seen.add(result_split[-1][0])
+for t in tags:
+    if (t not in seen):
+        print('%s: no results' % t)
+        exit()
 for i in dics:
     fib = i[1]
     if (expect[i[0]] != fib):
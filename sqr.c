@@ -1,3 +1,4 @@
+#include <linux/kernel.h>
 #include <linux/types.h>
 
 #include "apm.h"
@@ -7,6 +8,20 @@ extern void _apm_mul_base(const apm_digit *u,
                           const apm_digit *v,
                           apm_size vsize,
                           apm_digit *w);
+extern bool _apm_toom3_eval(const apm_digit *u,
+                            apm_size k,
+                            apm_size top,
+                            apm_digit *p1,
+                            apm_digit *pm1,
+                            apm_digit *p2);
+extern void _apm_toom3_interp(apm_digit *w,
+                              apm_size size,
+                              apm_size k,
+                              apm_digit *r1,
+                              apm_digit *rm1,
+                              apm_digit *r2,
+                              bool neg,
+                              apm_digit *t);
 
 /* Square diagonal. */
 static void apm_sqr_diag(const apm_digit *u, apm_size size, apm_digit *v)
@@ -90,14 +105,89 @@ static void apm_sqr_base(const apm_digit *u, apm_size usize, apm_digit *v)
     apm_sqr_diag(u, usize, v);
 }
 
+static void apm_sqr_n(const apm_digit *u,
+                      apm_size size,
+                      apm_digit *v,
+                      apm_digit *scratch);
+
+/* Return the number of scratch digits apm_sqr_n needs for a size-digit
+ * operand, shared the same way as for apm_mul_n. */
+static size_t apm_sqr_scratch(apm_size size)
+{
+    if (size < KARATSUBA_SQR_THRESHOLD)
+        return 0;
+    if (size >= TOOM3_SQR_THRESHOLD) {
+        const apm_size k = (size + 2) / 3;
+        return 11 * (size_t)(k + 1) + apm_sqr_scratch(k + 1);
+    }
+    const apm_size even_size = size & ~1;
+    return 2 * (size_t) even_size + apm_sqr_scratch(even_size / 2);
+}
+
+/* apm_sqr_n in the form of an apm_task. */
+static void apm_sqr_task(const apm_digit *u,
+                         const apm_digit *v,
+                         apm_size size,
+                         apm_digit *w,
+                         apm_digit *scratch)
+{
+    apm_sqr_n(u, size, w, scratch);
+}
+
+/* Toom-3 squaring, the multiplication of mul.c with V = U: U is evaluated only
+ * once, and U(-1)^2 needs no sign. The five squares are independent and all
+ * but the last may run on other CPUs.
+ */
+static void apm_sqr_toom3(const apm_digit *u,
+                          apm_size size,
+                          apm_digit *v,
+                          apm_digit *scratch)
+{
+    const apm_size k = (size + 2) / 3;
+    const apm_size top = size - 2 * k; /* Size of U2. */
+    const apm_size len = 2 * (k + 1);  /* Size of U(1)^2, U(-1)^2, U(2)^2. */
+
+    apm_digit *tmp = scratch;
+    scratch += 3 * (k + 1) + 4 * len;
+    const size_t scratch_size = apm_sqr_scratch(k + 1);
+    apm_digit *p1 = tmp, *pm1 = p1 + k + 1, *p2 = pm1 + k + 1;
+    apm_digit *r1 = p2 + k + 1, *rm1 = r1 + len, *r2 = rm1 + len;
+    apm_digit *t = r2 + len;
+
+    _apm_toom3_eval(u, k, top, p1, pm1, p2);
+
+    /* U0^2 => v[0..2k-1]; U2^2 => v[4k..2*size-1];
+     * U(1)^2 => r1; U(-1)^2 => rm1; U(2)^2 => r2. */
+    struct apm_task tasks[] = {
+        {.fn = apm_sqr_task, .u = u, .size = k, .w = v},
+        {.fn = apm_sqr_task, .u = u + 2 * k, .size = top, .w = v + 4 * k},
+        {.fn = apm_sqr_task, .u = p1, .size = k + 1, .w = r1},
+        {.fn = apm_sqr_task, .u = p2, .size = k + 1, .w = r2},
+    };
+    for (int i = 0; i < ARRAY_SIZE(tasks); i++) {
+        tasks[i].scratch = scratch;
+        tasks[i].scratch_size = scratch_size;
+        apm_fork(&tasks[i]);
+    }
+    apm_sqr_n(pm1, k + 1, rm1, scratch);
+    for (int i = 0; i < ARRAY_SIZE(tasks); i++)
+        apm_join(&tasks[i]);
+
+    _apm_toom3_interp(v, size, k, r1, rm1, r2, false, t);
+}
+
 /* Karatsuba squaring recursively applies the formula:
  *		U = U1*2^N + U0
  *		U^2 = (2^2N + 2^N)U1^2 - (U1-U0)^2 + (2^N + 1)U0^2
  * From my own testing this uses ~20% less time compared with slighly easier to
  * code formula:
  *		U^2 = (2^2N)U1^2 + (2^(N+1))(U1*U0) + U0^2
+ * Temporaries come from scratch, of apm_sqr_scratch(size) digits.
  */
-void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
+static void apm_sqr_n(const apm_digit *u,
+                      apm_size size,
+                      apm_digit *v,
+                      apm_digit *scratch)
 {
     apm_size rsize = apm_rsize(u, size);
     if (rsize != size) {
@@ -115,38 +205,57 @@ void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
         return;
     }
 
+    if (size >= TOOM3_SQR_THRESHOLD) {
+        apm_sqr_toom3(u, size, v, scratch);
+        return;
+    }
+
     const bool odd_size = size & 1;
     const apm_size even_size = size & ~1;
     const apm_size half_size = even_size / 2;
     const apm_digit *u0 = u, *u1 = u + half_size;
     apm_digit *v0 = v, *v1 = v + even_size;
 
-    /* Choose the appropriate squaring function. */
-    void (*sqr_fn)(const apm_digit *, apm_size, apm_digit *) =
-        (half_size >= KARATSUBA_SQR_THRESHOLD) ? apm_sqr : apm_sqr_base;
-    /* Compute the low and high squares, potentially recursively. */
-    sqr_fn(u0, half_size, v0); /* U0^2 => V0 */
-    sqr_fn(u1, half_size, v1); /* U1^2 => V1 */
-
-    apm_digit *tmp = APM_TMP_ALLOC(even_size * 2);
+    apm_digit *tmp = scratch;
     apm_digit *tmp2 = tmp + even_size;
+    scratch += even_size * 2;
+    /* tmp = |U1-U0| */
+    int cmp = apm_cmp_n(u1, u0, half_size);
+    if (cmp < 0)
+        apm_sub_n(u0, u1, half_size, tmp);
+    else if (cmp > 0)
+        apm_sub_n(u1, u0, half_size, tmp);
+
+    /* Compute the low and high squares, potentially recursively and on other
+     * CPUs, while this one does (U1-U0)^2 => tmp2. */
+    const size_t scratch_size = apm_sqr_scratch(half_size);
+    struct apm_task t0 = {.fn = apm_sqr_task,
+                          .u = u0,
+                          .size = half_size,
+                          .w = v0,
+                          .scratch = scratch,
+                          .scratch_size = scratch_size};
+    struct apm_task t1 = {.fn = apm_sqr_task,
+                          .u = u1,
+                          .size = half_size,
+                          .w = v1,
+                          .scratch = scratch,
+                          .scratch_size = scratch_size};
+    apm_fork(&t0); /* U0^2 => V0 */
+    apm_fork(&t1); /* U1^2 => V1 */
+    if (cmp)
+        apm_sqr_n(tmp, half_size, tmp2, scratch);
+    apm_join(&t0);
+    apm_join(&t1);
+
     /* tmp = w[0..even_size-1] */
     apm_copy(v0, even_size, tmp);
     /* v += U1^2 * 2^N */
     apm_digit cy = apm_addi_n(v + half_size, v1, even_size);
     /* v += U0^2 * 2^N */
     cy += apm_addi_n(v + half_size, tmp, even_size);
-
-    int cmp = apm_cmp_n(u1, u0, half_size);
-    if (cmp) {
-        if (cmp < 0)
-            apm_sub_n(u0, u1, half_size, tmp);
-        else
-            apm_sub_n(u1, u0, half_size, tmp);
-        sqr_fn(tmp, half_size, tmp2);
+    if (cmp)
         cy -= apm_subi_n(v + half_size, tmp2, even_size);
-    }
-    APM_TMP_FREE(tmp);
 
     if (cy) {
         ASSERT(apm_daddi(v + even_size + half_size, half_size, cy) == 0);
@@ -159,3 +268,23 @@ void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
             apm_dmul_add(u, size, u[even_size], &v[even_size]);
     }
 }
+
+void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
+{
+    apm_size rsize = apm_rsize(u, size);
+    if (rsize != size) {
+        apm_zero(v + rsize * 2, (size - rsize) * 2);
+        size = rsize;
+    }
+
+#ifdef NTT_SQR_THRESHOLD
+    if (size >= NTT_SQR_THRESHOLD && apm_mul_ntt(u, size, u, size, v))
+        return;
+#endif
+
+    /* One scratch area serves every level of the recursion. */
+    const size_t scratch_size = apm_sqr_scratch(size);
+    apm_digit *scratch = scratch_size ? APM_TMP_ALLOC(scratch_size) : NULL;
+    apm_sqr_n(u, size, v, scratch);
+    APM_TMP_FREE(scratch);
+}
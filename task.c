@@ -0,0 +1,73 @@
+#include <linux/atomic.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+
+#include "apm.h"
+
+/* Forked sub-products run on a workqueue of their own, whose unbound workers
+ * are picked up by whichever CPUs are idle. No more than apm_task_max tasks
+ * are out at a time, which is also the concurrency of the workqueue, so every
+ * forked task can start while its parent sleeps in apm_join and nested forks
+ * never wait on each other. Past that, apm_fork runs the task in place.
+ */
+static struct workqueue_struct *apm_wq;
+static atomic_t apm_tasks = ATOMIC_INIT(0);
+static int apm_task_max;
+
+/* A forked task computes in scratch of its own, allocated by apm_fork. */
+static void apm_task_fn(struct work_struct *work)
+{
+    struct apm_task *t = container_of(work, struct apm_task, work);
+    t->fn(t->u, t->v, t->size, t->w, t->scratch);
+    APM_TMP_FREE(t->scratch);
+}
+
+void apm_fork(struct apm_task *t)
+{
+    t->forked = false;
+    if (apm_wq && t->size >= APM_PARALLEL_THRESHOLD) {
+        if (atomic_inc_return(&apm_tasks) <= apm_task_max) {
+            /* The scratch of the parent is in use while the task runs, so
+             * without scratch of its own the task runs in place.
+             */
+            apm_digit *scratch = NULL;
+            if (t->scratch_size) {
+                scratch = APM_TMP_ALLOC(t->scratch_size);
+                if (!scratch) {
+                    atomic_dec(&apm_tasks);
+                    goto in_place;
+                }
+            }
+            t->scratch = scratch;
+            INIT_WORK_ONSTACK(&t->work, apm_task_fn);
+            queue_work(apm_wq, &t->work);
+            t->forked = true;
+            return;
+        }
+        atomic_dec(&apm_tasks);
+    }
+in_place:
+    t->fn(t->u, t->v, t->size, t->w, t->scratch);
+}
+
+void apm_join(struct apm_task *t)
+{
+    if (!t->forked)
+        return;
+    flush_work(&t->work);
+    destroy_work_on_stack(&t->work);
+    atomic_dec(&apm_tasks);
+}
+
+int apm_task_init(void)
+{
+    apm_task_max = 2 * num_online_cpus();
+    apm_wq = alloc_workqueue("apm", WQ_UNBOUND, apm_task_max);
+    return apm_wq ? 0 : -ENOMEM;
+}
+
+void apm_task_exit(void)
+{
+    destroy_workqueue(apm_wq);
+    apm_wq = NULL;
+}
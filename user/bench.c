@@ -0,0 +1,230 @@
+/* Microbenchmark of the apm library and the Fibonacci engines, built for user
+ * space against the shims in user/include.
+ *
+ * usage: bench [-r repeat] [-m max] [op...]
+ *
+ * Runs each op, or all of them, over sizes doubling from 1 limb for the apm
+ * operations and indices growing tenfold from 10 for the Fibonacci engines,
+ * up to the op's default limit or max. Every sample calls the op often enough
+ * to take about a millisecond. Prints CSV, one line per op and size:
+ *   op,size,calls,min_ns,median_ns
+ * where the times are per call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../bn.h"
+#include "../fibonacci.h"
+#include "../memory.h"
+#include "../mybignum.h"
+
+#define SAMPLE_NS 1000000ULL
+
+struct bench_args {
+    size_t size; /* limbs, or the index for Fibonacci engines */
+    apm_digit *u, *v, *w;
+    char *s;
+    size_t len; /* size of s */
+    bn *fib;
+};
+
+static void run_add(struct bench_args *a)
+{
+    apm_add_n(a->u, a->v, a->size, a->w);
+}
+
+static void run_mul(struct bench_args *a)
+{
+    apm_mul(a->u, a->size, a->v, a->size, a->w);
+}
+
+static void run_sqr(struct bench_args *a)
+{
+    apm_sqr(a->u, a->size, a->w);
+}
+
+static void run_sprint(struct bench_args *a)
+{
+    apm_sprint(a->u, a->size, 10, a->s);
+}
+
+static void run_snprint(struct bench_args *a)
+{
+    apm_snprint(a->u, a->size, 10, a->s, a->len);
+}
+
+static void run_fib(struct bench_args *a)
+{
+    ref_fibonacci(a->size, a->fib);
+}
+
+static void run_fib_fd(struct bench_args *a)
+{
+    ref_fd_fibonacci(a->size, a->fib);
+}
+
+static void run_fib_fd_par(struct bench_args *a)
+{
+    ref_fd_fibonacci_par(a->size, a->fib);
+}
+
+static void run_fib_mybn(struct bench_args *a)
+{
+    bignum *fib = my_bn_init(1);
+    my_bn_fib_sequence(a->size, fib);
+    my_bn_free(fib);
+}
+
+static void run_fib_mybn_fd(struct bench_args *a)
+{
+    bignum *fib = my_bn_init(1);
+    my_bn_fib_fastdoubling(a->size, fib);
+    my_bn_free(fib);
+}
+
+static const struct bench_op {
+    const char *name;
+    void (*run)(struct bench_args *a);
+    bool fib; /* size is an index */
+    size_t max;
+} bench_ops[] = {
+    {"add", run_add, false, 1 << 20},
+    {"mul", run_mul, false, 1 << 16},
+    {"sqr", run_sqr, false, 1 << 16},
+    {"sprint", run_sprint, false, 1 << 14},
+    {"snprint", run_snprint, false, 1 << 14},
+    {"fib", run_fib, true, 100000},
+    {"fib_fd", run_fib_fd, true, 1000000},
+    {"fib_fd_par", run_fib_fd_par, true, 1000000},
+    {"fib_mybn", run_fib_mybn, true, 10000},
+    {"fib_mybn_fd", run_fib_mybn_fd, true, 1000000},
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rand_state = 0x9e3779b97f4a7c15ULL;
+
+static apm_digit rand_digit(void)
+{
+    /* xorshift64* */
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return (apm_digit)(rand_state * 0x2545f4914f6cdd1dULL);
+}
+
+static apm_digit *rand_number(size_t size)
+{
+    apm_digit *u = apm_new(size);
+    for (size_t i = 0; i < size; i++)
+        u[i] = rand_digit();
+    u[size - 1] |= 1;
+    return u;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    const unsigned long long x = *(const unsigned long long *) a;
+    const unsigned long long y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench(const struct bench_op *op, size_t size, unsigned int repeat)
+{
+    struct bench_args a = {.size = size};
+    bn_t fib;
+    unsigned long long t[repeat];
+
+    bn_init(fib);
+    a.fib = fib;
+    if (!op->fib) {
+        a.u = rand_number(size);
+        a.v = rand_number(size);
+        a.w = apm_new(2 * size + 1);
+        a.len = apm_sprint_size(a.u, size, 10);
+        a.s = malloc(a.len);
+    }
+
+    /* Warm up, then find how many calls fill a sample. */
+    unsigned long long start = now_ns();
+    op->run(&a);
+    const unsigned long long once = now_ns() - start + 1;
+    const unsigned long long calls = once < SAMPLE_NS ? SAMPLE_NS / once : 1;
+
+    for (unsigned int r = 0; r < repeat; r++) {
+        start = now_ns();
+        for (unsigned long long c = 0; c < calls; c++)
+            op->run(&a);
+        t[r] = (now_ns() - start) / calls;
+    }
+    qsort(t, repeat, sizeof(*t), cmp_ull);
+    printf("%s,%zu,%llu,%llu,%llu\n", op->name, size, calls, t[0],
+           t[repeat / 2]);
+    fflush(stdout);
+
+    bn_free(fib);
+    apm_free(a.u);
+    apm_free(a.v);
+    apm_free(a.w);
+    free(a.s);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int repeat = 11;
+    size_t max = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:m:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repeat = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            max = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r repeat] [-m max] [op...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (!repeat)
+        repeat = 1;
+
+    if (xmem_init() || apm_task_init()) {
+        fprintf(stderr, "%s: initialization failed\n", argv[0]);
+        return 1;
+    }
+
+    printf("op,size,calls,min_ns,median_ns\n");
+    for (size_t i = 0; i < ARRAY_SIZE(bench_ops); i++) {
+        const struct bench_op *op = &bench_ops[i];
+        bool selected = optind == argc;
+
+        for (int j = optind; j < argc; j++)
+            selected |= !strcmp(argv[j], op->name);
+        if (!selected)
+            continue;
+
+        const size_t limit = max ? max : op->max;
+        for (size_t size = op->fib ? 10 : 1; size <= limit;
+             size *= op->fib ? 10 : 2)
+            bench(op, size, repeat);
+    }
+
+    ref_fd_prefix_free();
+    apm_format_exit();
+    apm_task_exit();
+    xmem_exit();
+    return 0;
+}
@@ -0,0 +1,259 @@
+/* Differential test of the apm library and the Fibonacci engines, built for
+ * user space against the shims in user/include.
+ *
+ * usage: difftest [seed]
+ *
+ * Prints one case per line for scripts/difftest.py to check against Python's
+ * integers. Operands and results of the apm operations are printed in hex
+ * straight from their limbs, so that only decimal conversion is checked
+ * through apm_sprint itself:
+ *   add U V W        W = U + V
+ *   mul U V W        W = U * V
+ *   sqr U W          W = U * U
+ *   dec U D          D = U in decimal
+ *   mul10 U V W      W = U * V, in decimal by my_bn_mul
+ *   fib ENGINE N D   D = F(N) in decimal
+ * Sizes straddle the thresholds between the multiplication and conversion
+ * algorithms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../bn.h"
+#include "../fibonacci.h"
+#include "../memory.h"
+#include "../mybignum.h"
+
+static const size_t sizes[] = {
+    1,    2,    3,    7,    10,   11,          /* schoolbook */
+    31,   32,   33,   63,   64,   65,   100,   /* Karatsuba, decimal halves */
+    255,  256,  257,  500,  1023, 1024, 1025,  /* Toom-3, parallel */
+    3000, 8191, 8192, 8200, 16383, 16384, 17000, /* NTT */
+};
+
+/* Decimal conversion is quadratic in Python, so it stops here. */
+#define DEC_MAX_SIZE 3000
+
+static const uint64_t fib_indices[] = {
+    0,   1,   2,   3,    10,   46,   47,    92,    93,     94,
+    100, 186, 187, 500, 1000, 4096, 10007, 50000, 100000, 1000000,
+};
+
+/* The iterative engines are quadratic. */
+#define FIB_ITER_MAX 100000
+#define FIB_MYBN_MAX 10000
+
+static uint64_t rand_state;
+
+static apm_digit rand_digit(void)
+{
+    /* xorshift64* */
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return (apm_digit)(rand_state * 0x2545f4914f6cdd1dULL);
+}
+
+/* A random number of exactly size limbs. Every fourth one is made of long
+ * runs of ones and zeros, which carries and borrows go all the way through.
+ */
+static apm_digit *rand_number(size_t size)
+{
+    apm_digit *u = apm_new(size);
+    const bool runs = !(rand_digit() & 3);
+
+    for (size_t i = 0; i < size; i++) {
+        u[i] = rand_digit();
+        if (runs)
+            u[i] = u[i] & 1 ? APM_DIGIT_MAX : 0;
+    }
+    if (!u[size - 1])
+        u[size - 1] = 1;
+    return u;
+}
+
+static void print_hex(const apm_digit *u, size_t size)
+{
+    APM_NORMALIZE(u, size);
+    if (!size) {
+        fputs(" 0", stdout);
+        return;
+    }
+    printf(" %llx", (unsigned long long) u[size - 1]);
+    for (size_t i = size - 1; i-- > 0;)
+        printf("%0*llx", APM_DIGIT_SIZE * 2, (unsigned long long) u[i]);
+}
+
+static void test_add(size_t usize, size_t vsize)
+{
+    apm_digit *u = rand_number(usize), *v = rand_number(vsize);
+    apm_digit *w = apm_new(usize + 1);
+
+    w[usize] = apm_add(u, usize, v, vsize, w);
+    fputs("add", stdout);
+    print_hex(u, usize);
+    print_hex(v, vsize);
+    print_hex(w, usize + 1);
+    putchar('\n');
+    apm_free(u);
+    apm_free(v);
+    apm_free(w);
+}
+
+static void test_mul(size_t usize, size_t vsize)
+{
+    apm_digit *u = rand_number(usize), *v = rand_number(vsize);
+    apm_digit *w = apm_new(usize + vsize);
+
+    apm_mul(u, usize, v, vsize, w);
+    fputs("mul", stdout);
+    print_hex(u, usize);
+    print_hex(v, vsize);
+    print_hex(w, usize + vsize);
+    putchar('\n');
+    apm_free(u);
+    apm_free(v);
+    apm_free(w);
+}
+
+static void test_sqr(size_t size)
+{
+    apm_digit *u = rand_number(size), *w = apm_new(2 * size);
+
+    apm_sqr(u, size, w);
+    fputs("sqr", stdout);
+    print_hex(u, size);
+    print_hex(w, 2 * size);
+    putchar('\n');
+    apm_free(u);
+    apm_free(w);
+}
+
+static void test_dec(size_t size)
+{
+    apm_digit *u = rand_number(size);
+    char *s = malloc(apm_sprint_size(u, size, 10));
+
+    apm_sprint(u, size, 10, s);
+    fputs("dec", stdout);
+    print_hex(u, size);
+    printf(" %s\n", s);
+    apm_free(u);
+    free(s);
+}
+
+static bignum *rand_decimal(size_t size)
+{
+    bignum *u = my_bn_init(size);
+
+    for (size_t i = 0; i < size; i++)
+        u->number[i] = rand_digit() % MY_BN_BASE;
+    if (!u->number[size - 1])
+        u->number[size - 1] = 1;
+    return u;
+}
+
+static void test_mul10(size_t usize, size_t vsize)
+{
+    bignum *u = rand_decimal(usize), *v = rand_decimal(vsize);
+    bignum *w = my_bn_init(1);
+
+    if (my_bn_mul(u, v, w)) {
+        fputs("my_bn_mul failed\n", stderr);
+        exit(1);
+    }
+    char *su = my_bn_to_str(u), *sv = my_bn_to_str(v), *sw = my_bn_to_str(w);
+    printf("mul10 %s %s %s\n", su, sv, sw);
+    kfree(su);
+    kfree(sv);
+    kfree(sw);
+    my_bn_free(u);
+    my_bn_free(v);
+    my_bn_free(w);
+}
+
+/* ref_fibonacci, which can't fail, as the fast doubling engines are called. */
+static int ref_iter_fibonacci(uint64_t n, bn *fib)
+{
+    ref_fibonacci(n, fib);
+    return 0;
+}
+
+static void test_fib(const char *engine, int (*f)(uint64_t, bn *), uint64_t n)
+{
+    bn_t fib;
+    bn_init(fib);
+    if (f(n, fib)) {
+        fprintf(stderr, "%s: F(%llu) failed\n", engine, (unsigned long long) n);
+        exit(1);
+    }
+
+    char *s = malloc(bn_sprint_size(fib, 10));
+    bn_sprint(fib, 10, s);
+    printf("fib %s %llu %s\n", engine, (unsigned long long) n, s);
+    free(s);
+    bn_free(fib);
+}
+
+static void test_fib_mybn(const char *engine,
+                          int (*f)(long long, bignum *),
+                          uint64_t n)
+{
+    bignum *fib = my_bn_init(1);
+    if (f(n, fib)) {
+        fprintf(stderr, "%s: F(%llu) failed\n", engine, (unsigned long long) n);
+        exit(1);
+    }
+
+    char *s = my_bn_to_str(fib);
+    printf("fib %s %llu %s\n", engine, (unsigned long long) n, s);
+    kfree(s);
+    my_bn_free(fib);
+}
+
+int main(int argc, char *argv[])
+{
+    rand_state = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    if (!rand_state)
+        rand_state = 1;
+
+    if (xmem_init() || apm_task_init()) {
+        fprintf(stderr, "%s: initialization failed\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        const size_t size = sizes[i];
+        const size_t other = 1 + rand_digit() % size;
+
+        test_add(size, size);
+        test_add(size, other);
+        test_mul(size, size);
+        test_mul(size, other);
+        test_sqr(size);
+        if (size <= DEC_MAX_SIZE) {
+            test_dec(size);
+            test_mul10(size, size);
+            test_mul10(size, other);
+        }
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(fib_indices); i++) {
+        const uint64_t n = fib_indices[i];
+
+        test_fib("fd", ref_fd_fibonacci, n);
+        test_fib("fd_par", ref_fd_fibonacci_par, n);
+        if (n <= FIB_ITER_MAX)
+            test_fib("iter", ref_iter_fibonacci, n);
+        test_fib_mybn("mybn_fd", my_bn_fib_fastdoubling, n);
+        if (n <= FIB_MYBN_MAX)
+            test_fib_mybn("mybn", my_bn_fib_sequence, n);
+    }
+
+    ref_fd_prefix_free();
+    apm_format_exit();
+    apm_task_exit();
+    xmem_exit();
+    return 0;
+}
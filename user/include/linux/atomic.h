@@ -0,0 +1,21 @@
+#ifndef _USER_LINUX_ATOMIC_H_
+#define _USER_LINUX_ATOMIC_H_
+
+typedef struct {
+    int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) \
+    {                  \
+        (i)            \
+    }
+
+#define atomic_inc_return(v) \
+    __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec(v) \
+    ((void) __atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#endif /* !_USER_LINUX_ATOMIC_H_ */
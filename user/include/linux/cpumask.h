@@ -0,0 +1,8 @@
+#ifndef _USER_LINUX_CPUMASK_H_
+#define _USER_LINUX_CPUMASK_H_
+
+#include <unistd.h>
+
+#define num_online_cpus() ((unsigned int) sysconf(_SC_NPROCESSORS_ONLN))
+
+#endif /* !_USER_LINUX_CPUMASK_H_ */
@@ -0,0 +1,6 @@
+#ifndef _USER_LINUX_CTYPE_H_
+#define _USER_LINUX_CTYPE_H_
+
+#include <ctype.h>
+
+#endif /* !_USER_LINUX_CTYPE_H_ */
@@ -0,0 +1,30 @@
+#ifndef _USER_LINUX_KERNEL_H_
+#define _USER_LINUX_KERNEL_H_
+
+#include <linux/printk.h>
+#include <linux/types.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define container_of(ptr, type, member) \
+    ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define min(a, b)                  \
+    ({                             \
+        __typeof__(a) _a = (a);    \
+        __typeof__(b) _b = (b);    \
+        _a < _b ? _a : _b;         \
+    })
+#define max(a, b)                  \
+    ({                             \
+        __typeof__(a) _a = (a);    \
+        __typeof__(b) _b = (b);    \
+        _a > _b ? _a : _b;         \
+    })
+#define min_t(t, a, b) min((t) (a), (t) (b))
+#define max_t(t, a, b) max((t) (a), (t) (b))
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#endif /* !_USER_LINUX_KERNEL_H_ */
@@ -0,0 +1,17 @@
+#ifndef _USER_LINUX_LOCAL_LOCK_H_
+#define _USER_LINUX_LOCAL_LOCK_H_
+
+#include <linux/percpu.h>
+
+/* Every local lock is the lock of the single "CPU". */
+typedef struct {
+} local_lock_t;
+
+#define INIT_LOCAL_LOCK(lockname) {}
+
+#define local_lock_irqsave(l, flags) \
+    ((void) (l), (flags) = 0, mutex_lock(user_cpu_lock()))
+#define local_unlock_irqrestore(l, flags) \
+    ((void) (l), (void) (flags), mutex_unlock(user_cpu_lock()))
+
+#endif /* !_USER_LINUX_LOCAL_LOCK_H_ */
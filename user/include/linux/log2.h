@@ -0,0 +1,7 @@
+#ifndef _USER_LINUX_LOG2_H_
+#define _USER_LINUX_LOG2_H_
+
+#define ilog2(n) (63 - __builtin_clzll((unsigned long long) (n)))
+#define order_base_2(n) ((n) <= 1 ? 0 : ilog2((n) - 1) + 1)
+
+#endif /* !_USER_LINUX_LOG2_H_ */
@@ -0,0 +1,17 @@
+#ifndef _USER_LINUX_MATH64_H_
+#define _USER_LINUX_MATH64_H_
+
+#include <linux/types.h>
+
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder)
+{
+    *remainder = dividend % divisor;
+    return dividend / divisor;
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+#endif /* !_USER_LINUX_MATH64_H_ */
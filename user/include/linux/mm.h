@@ -0,0 +1,21 @@
+#ifndef _USER_LINUX_MM_H_
+#define _USER_LINUX_MM_H_
+
+#include <linux/slab.h>
+
+static inline void *kvmalloc(size_t size, gfp_t flags)
+{
+    return malloc(size);
+}
+
+static inline void *kvmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+    return n && size > SIZE_MAX / n ? NULL : malloc(n * size);
+}
+
+static inline void kvfree(const void *p)
+{
+    free((void *) p);
+}
+
+#endif /* !_USER_LINUX_MM_H_ */
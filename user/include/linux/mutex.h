@@ -0,0 +1,17 @@
+#ifndef _USER_LINUX_MUTEX_H_
+#define _USER_LINUX_MUTEX_H_
+
+#include <pthread.h>
+
+#include <linux/atomic.h>
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = {PTHREAD_MUTEX_INITIALIZER}
+
+#define mutex_lock(l) pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l) pthread_mutex_unlock(&(l)->m)
+
+#endif /* !_USER_LINUX_MUTEX_H_ */
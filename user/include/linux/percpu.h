@@ -0,0 +1,23 @@
+#ifndef _USER_LINUX_PERCPU_H_
+#define _USER_LINUX_PERCPU_H_
+
+#include <linux/mutex.h>
+
+/* There is a single "CPU", whose variables are guarded by a lock so that the
+ * threads running work items can share them.
+ */
+static inline struct mutex *user_cpu_lock(void)
+{
+    static struct mutex lock = {PTHREAD_MUTEX_INITIALIZER};
+    return &lock;
+}
+
+#define DEFINE_PER_CPU(type, name) type name
+
+#define get_cpu_ptr(p) (mutex_lock(user_cpu_lock()), (p))
+#define put_cpu_ptr(p) mutex_unlock(user_cpu_lock())
+#define this_cpu_ptr(p) (p)
+#define per_cpu_ptr(p, cpu) ((void) (cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+#endif /* !_USER_LINUX_PERCPU_H_ */
@@ -0,0 +1,11 @@
+#ifndef _USER_LINUX_PRINTK_H_
+#define _USER_LINUX_PRINTK_H_
+
+#include <stdio.h>
+
+/* Messages go to stderr, leaving stdout to the results of the tools. */
+#define KERN_ALERT ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define pr_info(...) fprintf(stderr, __VA_ARGS__)
+
+#endif /* !_USER_LINUX_PRINTK_H_ */
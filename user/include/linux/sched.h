@@ -0,0 +1,9 @@
+#ifndef _USER_LINUX_SCHED_H_
+#define _USER_LINUX_SCHED_H_
+
+/* Threads are preempted by the host kernel. */
+#define cond_resched() \
+    do {               \
+    } while (0)
+
+#endif /* !_USER_LINUX_SCHED_H_ */
@@ -0,0 +1,10 @@
+#ifndef _USER_LINUX_SCHED_SIGNAL_H_
+#define _USER_LINUX_SCHED_SIGNAL_H_
+
+#include <stdbool.h>
+
+/* A killed process takes its threads along; nothing is left to check. */
+#define current NULL
+#define fatal_signal_pending(p) ((void) (p), false)
+
+#endif /* !_USER_LINUX_SCHED_SIGNAL_H_ */
@@ -0,0 +1,78 @@
+#ifndef _USER_LINUX_SLAB_H_
+#define _USER_LINUX_SLAB_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/types.h>
+
+#define GFP_KERNEL 0U
+#define __GFP_NOWARN 0U
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+    return calloc(1, size);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+    return n && size > SIZE_MAX / n ? NULL : malloc(n * size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+    return calloc(n, size);
+}
+
+static inline void *krealloc(const void *p, size_t size, gfp_t flags)
+{
+    return realloc((void *) p, size);
+}
+
+static inline void kfree(const void *p)
+{
+    free((void *) p);
+}
+
+/* A cache is only its object size; objects come from malloc. */
+struct kmem_cache {
+    size_t size;
+    size_t align;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name,
+                                                   unsigned int size,
+                                                   unsigned int align,
+                                                   unsigned long flags,
+                                                   void (*ctor)(void *))
+{
+    struct kmem_cache *c = malloc(sizeof(*c));
+    if (c) {
+        c->size = size;
+        c->align = align < sizeof(void *) ? sizeof(void *) : align;
+    }
+    return c;
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *c)
+{
+    free(c);
+}
+
+static inline void *kmem_cache_alloc(struct kmem_cache *c, gfp_t flags)
+{
+    void *p;
+    return posix_memalign(&p, c->align, c->size) ? NULL : p;
+}
+
+static inline void kmem_cache_free(struct kmem_cache *c, void *p)
+{
+    free(p);
+}
+
+#endif /* !_USER_LINUX_SLAB_H_ */
@@ -0,0 +1,6 @@
+#ifndef _USER_LINUX_STRING_H_
+#define _USER_LINUX_STRING_H_
+
+#include <string.h>
+
+#endif /* !_USER_LINUX_STRING_H_ */
@@ -0,0 +1,26 @@
+#ifndef _USER_LINUX_TYPES_H_
+#define _USER_LINUX_TYPES_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t s32;
+/* long long, as in the kernel, so that %llu fits them everywhere */
+typedef unsigned long long u64;
+typedef long long s64;
+
+typedef unsigned int gfp_t;
+
+/* Spelled as format.c spells it, which it then redefines harmlessly. */
+#undef UINT64_C
+#define UINT64_C(c) c##ULL
+
+#define __aligned(x) __attribute__((aligned(x)))
+
+#endif /* !_USER_LINUX_TYPES_H_ */
@@ -0,0 +1,75 @@
+#ifndef _USER_LINUX_WORKQUEUE_H_
+#define _USER_LINUX_WORKQUEUE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <linux/kernel.h>
+
+/* Every queued work item runs on a thread of its own, which flush_work
+ * joins. That is enough for the fork-join use of the apm library.
+ */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+    work_func_t func;
+    pthread_t thread;
+    bool queued;
+};
+
+struct workqueue_struct {
+    const char *name;
+};
+
+#define WQ_UNBOUND 0
+
+static inline struct workqueue_struct *user_unbound_wq(void)
+{
+    static struct workqueue_struct wq = {"events_unbound"};
+    return &wq;
+}
+#define system_unbound_wq user_unbound_wq()
+
+#define INIT_WORK_ONSTACK(w, f) ((w)->func = (f), (w)->queued = false)
+#define destroy_work_on_stack(w) ((void) (w))
+
+static inline void *user_work_thread(void *arg)
+{
+    struct work_struct *w = arg;
+    w->func(w);
+    return NULL;
+}
+
+static inline bool queue_work(struct workqueue_struct *wq,
+                              struct work_struct *w)
+{
+    if (pthread_create(&w->thread, NULL, user_work_thread, w)) {
+        w->func(w);
+        return true;
+    }
+    w->queued = true;
+    return true;
+}
+
+static inline bool flush_work(struct work_struct *w)
+{
+    if (!w->queued)
+        return false;
+    pthread_join(w->thread, NULL);
+    w->queued = false;
+    return true;
+}
+
+static inline struct workqueue_struct *alloc_workqueue(const char *name,
+                                                       unsigned int flags,
+                                                       int max_active)
+{
+    static struct workqueue_struct wq;
+    wq.name = name;
+    return &wq;
+}
+
+static inline void destroy_workqueue(struct workqueue_struct *wq) {}
+
+#endif /* !_USER_LINUX_WORKQUEUE_H_ */